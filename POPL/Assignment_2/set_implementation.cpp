@@ -2,39 +2,477 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <vector>
+#include <algorithm>
+#include <utility>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <list>
+#include <map>
+#include <math.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SET_X86_KERNELS 1
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
 /* Variables for range of universe. */
-int range_start = 0;
-int range_end = 0;
+long long range_start = 0;
+long long range_end = 0;
 int operation = 0;
 
+/*
+ * This function returns the offset of the last number of the range, its width minus one.
+ * The numbers are stored by their offset from range_start, which fits in 64 bits for any range.
+ */
+uint64_t range_last()
+{
+	return (uint64_t)range_end-(uint64_t)range_start;
+}
+
+/* Storage used for the sets, chosen from the range and the size of the input when automatic. */
+#define AUTO_BACKEND 0
+#define DENSE_BACKEND 1
+#define SPARSE_BACKEND 2
+int backend = AUTO_BACKEND;
+
+/* The input files are sorted, they are merged without making sets (--sorted). */
+bool sorted_inputs = false;
+
+/* Write the output as a binary file (--binary), and trust the checksums of inputs (--no-verify). */
+bool binary_output = false;
+bool verify_checksums = true;
+
+/* Number of threads used by the tool (--threads). */
+int thread_count = thread::hardware_concurrency() ? thread::hardware_concurrency() : 1;
+
+/*
+ * The number of threads an operation of this thread can use, 0 for thread_count. The workers of
+ * the batch mode set it to 1, so their operations do not start more threads, see run_batch().
+ */
+thread_local int operation_threads = 0;
+
+/* This function gives the number of threads an operation of this thread can use. */
+inline int usable_threads()
+{
+	return operation_threads>0 ? operation_threads : thread_count;
+}
+
+/* The pages of a set are first touched by the threads that work on them (--first-touch). */
+bool first_touch = false;
+
 /* Filename for input and output. */
 string input_file1 = "";
 string input_file2 = "";
 string output_file = "";
 
+/* Set expression over any number of input files, given with --expr. */
+string expression = "";
+
+/* Union or intersection of any number of input files (--kway), or the numbers in at least k of them (--at-least k). */
+bool kway = false;
+long long at_least = 0;
+
+/* The input files of --expr, --kway and --at-least. */
+vector<string> input_files;
+
+/* Script of the batch mode, and the memory for the sets it keeps loaded, or --kway loads at a time. */
+string batch_file = "";
+size_t cache_budget = (size_t)1<<30;
+
+/* Report the time and the work of each phase, to stderr (--stats) or to a JSON file (--stats-json). */
+bool show_stats = false;
+string stats_file = "";
+
+/* Binary file of a result updated with the deltas of the inputs (--delta). */
+string delta_result = "";
+
+/*
+ * Word-wise operations used by the set kernels.
+ * Each operation provides a scalar version and, on x86, the AVX2 and AVX-512 versions.
+ */
+struct op_or
+{
+	static inline uint64_t apply(uint64_t a, uint64_t b) { return a|b; }
+#ifdef SET_X86_KERNELS
+	static inline __attribute__((target("avx2"))) __m256i apply(__m256i a, __m256i b) { return _mm256_or_si256(a, b); }
+	static inline __attribute__((target("avx512f"))) __m512i apply(__m512i a, __m512i b) { return _mm512_or_si512(a, b); }
+#endif
+};
+
+struct op_and
+{
+	static inline uint64_t apply(uint64_t a, uint64_t b) { return a&b; }
+#ifdef SET_X86_KERNELS
+	static inline __attribute__((target("avx2"))) __m256i apply(__m256i a, __m256i b) { return _mm256_and_si256(a, b); }
+	static inline __attribute__((target("avx512f"))) __m512i apply(__m512i a, __m512i b) { return _mm512_and_si512(a, b); }
+#endif
+};
+
+/* a and not b, i.e. the members of a that are not in b. */
+struct op_andnot
+{
+	static inline uint64_t apply(uint64_t a, uint64_t b) { return a&~b; }
+#ifdef SET_X86_KERNELS
+	static inline __attribute__((target("avx2"))) __m256i apply(__m256i a, __m256i b) { return _mm256_andnot_si256(b, a); }
+	static inline __attribute__((target("avx512f"))) __m512i apply(__m512i a, __m512i b) { return _mm512_ternarylogic_epi64(a, b, b, 0x30); }
+#endif
+};
+
+struct op_xor
+{
+	static inline uint64_t apply(uint64_t a, uint64_t b) { return a^b; }
+#ifdef SET_X86_KERNELS
+	static inline __attribute__((target("avx2"))) __m256i apply(__m256i a, __m256i b) { return _mm256_xor_si256(a, b); }
+	static inline __attribute__((target("avx512f"))) __m512i apply(__m512i a, __m512i b) { return _mm512_xor_si512(a, b); }
+#endif
+};
+
+/* A kernel computes c[i] = a[i] op b[i] for the n words of the sets. */
+typedef void (*kernel_fn)(uint64_t *c, const uint64_t *a, const uint64_t *b, size_t n);
+
+/* portable version of the kernels, one word at a time. */
+template<class OP>
+void kernel_scalar(uint64_t *c, const uint64_t *a, const uint64_t *b, size_t n)
+{
+	for(size_t i=0; i<n; i++)
+		c[i] = OP::apply(a[i], b[i]);
+}
+
+#ifdef SET_X86_KERNELS
+/* AVX2 version of the kernels, four words at a time. */
+template<class OP>
+__attribute__((target("avx2"))) void kernel_avx2(uint64_t *c, const uint64_t *a, const uint64_t *b, size_t n)
+{
+	size_t i = 0;
+	for(; i+4<=n; i+=4)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)(a+i));
+		__m256i y = _mm256_loadu_si256((const __m256i*)(b+i));
+		_mm256_storeu_si256((__m256i*)(c+i), OP::apply(x, y));
+	}
+
+	/* the remaining words. */
+	for(; i<n; i++)
+		c[i] = OP::apply(a[i], b[i]);
+}
+
+/* AVX-512 version of the kernels, eight words at a time. */
+template<class OP>
+__attribute__((target("avx512f"))) void kernel_avx512(uint64_t *c, const uint64_t *a, const uint64_t *b, size_t n)
+{
+	size_t i = 0;
+	for(; i+8<=n; i+=8)
+	{
+		__m512i x = _mm512_loadu_si512((const void*)(a+i));
+		__m512i y = _mm512_loadu_si512((const void*)(b+i));
+		_mm512_storeu_si512((void*)(c+i), OP::apply(x, y));
+	}
+
+	/* the remaining words. */
+	for(; i<n; i++)
+		c[i] = OP::apply(a[i], b[i]);
+}
+#endif
+
+/*
+ * This function picks the best version of a kernel supported by the processor.
+ * @return kernel_fn: the AVX-512, AVX2 or the scalar version of the kernel.
+ */
+template<class OP>
+kernel_fn select_kernel()
+{
+#ifdef SET_X86_KERNELS
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+		return kernel_avx512<OP>;
+	if(__builtin_cpu_supports("avx2"))
+		return kernel_avx2<OP>;
+#endif
+	return kernel_scalar<OP>;
+}
+
+/* Kernels used by the set operations, selected once at start up. */
+kernel_fn kernel_or = select_kernel<op_or>();
+kernel_fn kernel_and = select_kernel<op_and>();
+kernel_fn kernel_andnot = select_kernel<op_andnot>();
+kernel_fn kernel_xor = select_kernel<op_xor>();
+
+/* A count kernel returns the number of bits set in a[i] op b[i] over the n words, without storing them. */
+typedef uint64_t (*count_fn)(const uint64_t *a, const uint64_t *b, size_t n);
+
+/* portable version of the count kernels. */
+template<class OP>
+uint64_t count_scalar(const uint64_t *a, const uint64_t *b, size_t n)
+{
+	uint64_t count = 0;
+	for(size_t i=0; i<n; i++)
+		count += __builtin_popcountll(OP::apply(a[i], b[i]));
+	return count;
+}
+
+#ifdef SET_X86_KERNELS
+/* version of the count kernels with the popcnt instruction. */
+template<class OP>
+__attribute__((target("popcnt"))) uint64_t count_popcnt(const uint64_t *a, const uint64_t *b, size_t n)
+{
+	uint64_t count = 0;
+	for(size_t i=0; i<n; i++)
+		count += __builtin_popcountll(OP::apply(a[i], b[i]));
+	return count;
+}
+
+/* AVX-512 version of the count kernels, counting eight words at a time. */
+template<class OP>
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt"))) uint64_t count_avx512(const uint64_t *a, const uint64_t *b, size_t n)
+{
+	__m512i total = _mm512_setzero_si512();
+	size_t i = 0;
+	for(; i+8<=n; i+=8)
+	{
+		__m512i x = _mm512_loadu_si512((const void*)(a+i));
+		__m512i y = _mm512_loadu_si512((const void*)(b+i));
+		total = _mm512_add_epi64(total, _mm512_popcnt_epi64(OP::apply(x, y)));
+	}
+
+	/* adding the eight counts, then the remaining words. */
+	uint64_t lanes[8];
+	_mm512_storeu_si512((void*)lanes, total);
+	uint64_t count = 0;
+	for(int k=0; k<8; k++)
+		count += lanes[k];
+	for(; i<n; i++)
+		count += __builtin_popcountll(OP::apply(a[i], b[i]));
+	return count;
+}
+#endif
+
+/* This function picks the best version of a count kernel supported by the processor. */
+template<class OP>
+count_fn select_count()
+{
+#ifdef SET_X86_KERNELS
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512vpopcntdq"))
+		return count_avx512<OP>;
+	if(__builtin_cpu_supports("popcnt"))
+		return count_popcnt<OP>;
+#endif
+	return count_scalar<OP>;
+}
+
+count_fn count_or = select_count<op_or>();
+count_fn count_and = select_count<op_and>();
+count_fn count_andnot = select_count<op_andnot>();
+count_fn count_xor = select_count<op_xor>();
+
+/* Number of words in a shard of a set, the words of the operands of a shard fit in the cache. */
+#define SHARD_WORDS (1<<15)
+
+/*
+ * This function calls f(first, count) for the shards of n words, on up to usable_threads() threads.
+ * Each thread owns a contiguous part of the shards, the same part for all sets of the same size,
+ * and goes through it in order. A thread that is done takes the remaining shards of the others.
+ * @param n: number of words.
+ * @param shard: number of words in a shard.
+ * @param f: called once for each shard, from any of the threads.
+ */
+template<class F>
+void for_each_shard(size_t n, size_t shard, F f)
+{
+	size_t shards = (n+shard-1)/shard;
+	int threads = (int)min((size_t)usable_threads(), shards);
+	if(threads<=1)
+	{
+		if(n)
+			f((size_t)0, n);
+		return;
+	}
+
+	/* the next shard and the end of the part of each thread, on their own cache lines. */
+	struct alignas(64) part
+	{
+		atomic<size_t> next;
+		size_t end;
+	};
+	vector<part> parts(threads);
+	for(int t=0; t<threads; t++)
+	{
+		parts[t].next = shards*t/threads;
+		parts[t].end = shards*(t+1)/threads;
+	}
+
+	auto work = [&](int t)
+	{
+		for(int k=0; k<threads; k++)
+		{
+			part &p = parts[(t+k)%threads];
+			size_t s;
+			while((s = p.next.fetch_add(1))<p.end)
+				f(s*shard, min(shard, n-s*shard));
+		}
+	};
+
+	vector<thread> pool;
+	for(int t=1; t<threads; t++)
+		pool.push_back(thread(work, t));
+	work(0);
+	for(size_t t=0; t<pool.size(); t++)
+		pool[t].join();
+}
+
+/* This function runs a word kernel over the shards of the words, see for_each_shard(). */
+void run_kernel(kernel_fn kernel, uint64_t *c, const uint64_t *a, const uint64_t *b, size_t n)
+{
+	for_each_shard(n, SHARD_WORDS, [&](size_t first, size_t count)
+	{
+		kernel(c+first, a+first, b+first, count);
+	});
+}
+
 /*
  * This class implements the mathematical set structure for integers.
- * @data-member bit_set: a boolean vector, that stores the presence of a number in a set.
- * @data-member len: stores the length of range.
+ * @data-member words: the bits of the set packed in 64-bit words, bit i stores the presence of range_start+i.
+ * @data-member last: stores the offset of the last number of the range.
  * @method: contains(), add(), set_union(), set_intersection(), set_difference(), set_set_difference.
+ * @method: union_with(), intersect_with(), subtract(), symmetric_subtract_with() do the operations in place.
+ * The bits after last in the last word are always zero, so the operations can work on whole words.
+ * The operations are split in shards of the words, done by many threads, see for_each_shard().
  */
 class set
 {
-	vector<bool>bit_set;
-	int len;
+	uint64_t *words;
+	size_t n_words;
+	uint64_t last;
+
+	/* the file mapping that holds the words of a set loaded from a binary file, or NULL. */
+	void *mapping;
+	size_t mapping_size;
+
+	/* This function releases the words, freeing them or unmapping the file that holds them. */
+	void release()
+	{
+		if(mapping!=NULL)
+			munmap(mapping, mapping_size);
+		else
+			free(words);
+	}
+
+	/*
+	 * This function allocates zeroed words for the set.
+	 * calloc() gets large blocks straight from mmap, which are already zero,
+	 * so the pages are only touched when they are first used.
+	 * With --first-touch the pages are touched at once by the threads that own their shards,
+	 * which places them on the NUMA node of that thread.
+	 */
+	static uint64_t* allocate_words(size_t n)
+	{
+		uint64_t *w = (uint64_t*)calloc(n, sizeof(uint64_t));
+
+		/* If memory could not be allocated. */
+		if(w==NULL)
+		{
+			cout<<"ERROR: Could not allocate memory for the set.\n";
+			exit(0);
+		}
+
+		if(first_touch)
+		{
+			for_each_shard(n, SHARD_WORDS, [&](size_t first, size_t count)
+			{
+				memset(w+first, 0, count*sizeof(uint64_t));
+			});
+		}
+
+		return w;
+	}
 
 	public:
 		set()	/* constructor for the class. */
 		{
-			len = range_end-range_start+1;
+			last = range_last();
+
+			/* Allocating the words, all numbers are absent initially. */
+			n_words = last/64+1;
+			words = allocate_words(n_words);
+			mapping = NULL;
+			mapping_size = 0;
+		}
+
+		/* copy constructor, duplicates the words. */
+		set(const set &b)
+		{
+			last = b.last;
+			n_words = b.n_words;
+			words = allocate_words(n_words);
+			for_each_shard(n_words, SHARD_WORDS, [&](size_t first, size_t count)
+			{
+				memcpy(words+first, b.words+first, count*sizeof(uint64_t));
+			});
+			mapping = NULL;
+			mapping_size = 0;
+		}
+
+		/* move constructor, takes over the words of b. */
+		set(set &&b)
+		{
+			last = b.last;
+			n_words = b.n_words;
+			words = b.words;
+			mapping = b.mapping;
+			mapping_size = b.mapping_size;
+			b.words = NULL;
+			b.n_words = 0;
+			b.mapping = NULL;
+		}
+
+		/* assignment works for both copies and moves, b is constructed by the right one. */
+		set& operator=(set b)
+		{
+			swap(words, b.words);
+			swap(n_words, b.n_words);
+			swap(last, b.last);
+			swap(mapping, b.mapping);
+			swap(mapping_size, b.mapping_size);
+			return *this;
+		}
+
+		/* destructor for the class. */
+		~set()
+		{
+			release();
+		}
 
-			/* Initializing the vector. */
-			for(int i=0; i<len; i++)
-				bit_set.push_back(false);
+		/*
+		 * This function makes the set use words inside a private mapping of a file, without
+		 * copying them. Changes to the words are copied on write and never reach the file.
+		 * @param w: the words, inside the mapping.
+		 * @param map, map_size: the mapping, unmapped with the set.
+		 */
+		void adopt_mapping(uint64_t *w, void *map, size_t map_size)
+		{
+			release();
+			words = w;
+			mapping = map;
+			mapping_size = map_size;
 		}
 
 		/*
@@ -42,9 +480,10 @@ class set
 		 * @param n: the integer to be checked.
 		 * return bool: true if the integer is present, else false.
 		 */
-		bool contains(int n)
+		bool contains(long long n) const
 		{
-			return bit_set[n-range_start];
+			uint64_t i = (uint64_t)n-(uint64_t)range_start;
+			return (words[i>>6]>>(i&63))&1;
 		}
 
 		/*
@@ -52,391 +491,4474 @@ class set
 		 * @param n: the integer to be added.
 		 * return bool: true if the integer was added, false if the integer was already present.
 		 */
-		bool add(int n)
+		bool add(long long n)
 		{
 			if(contains(n))
 				return false;
 
-			bit_set[n-range_start].flip();
+			uint64_t i = (uint64_t)n-(uint64_t)range_start;
+			words[i>>6] |= (uint64_t)1<<(i&63);
+			return true;
+		}
+
+		/*
+		 * This function adds an integer to the set, it can be called by many threads at once.
+		 * @param n: the integer to be added.
+		 * return bool: true if the integer was added, false if the integer was already present.
+		 */
+		bool add_atomic(long long n)
+		{
+			uint64_t i = (uint64_t)n-(uint64_t)range_start;
+			uint64_t bit = (uint64_t)1<<(i&63);
+			return !(__atomic_fetch_or(&words[i>>6], bit, __ATOMIC_RELAXED)&bit);
+		}
+
+		/* the packed words of the set, for the functions that scan it a word at a time. */
+		const uint64_t* data() const
+		{
+			return words;
+		}
+
+		uint64_t* data()
+		{
+			return words;
+		}
+
+		size_t word_count() const
+		{
+			return n_words;
+		}
+
+		/*
+		 * These functions count the members of the set, or of the result of an operation,
+		 * without making the result.
+		 * @param b: the other set of the operation.
+		 * @return uint64_t: the number of members.
+		 */
+		uint64_t cardinality() const
+		{
+			return count_or(words, words, n_words);
+		}
+
+		uint64_t union_cardinality(const set &b) const
+		{
+			return count_or(words, b.words, n_words);
+		}
+
+		uint64_t intersection_cardinality(const set &b) const
+		{
+			return count_and(words, b.words, n_words);
+		}
+
+		uint64_t difference_cardinality(const set &b) const
+		{
+			return count_andnot(words, b.words, n_words);
+		}
+
+		uint64_t sym_difference_cardinality(const set &b) const
+		{
+			return count_xor(words, b.words, n_words);
+		}
+
+		/*
+		 * This function computes the Jaccard similarity, the size of the intersection over the
+		 * size of the union. Two empty sets are taken as equal, with similarity 1.
+		 */
+		double jaccard(const set &b) const
+		{
+			uint64_t both = intersection_cardinality(b), any = union_cardinality(b);
+			return any ? (double)both/any : 1.0;
+		}
+
+		/* This function checks if the current set is a subset of b, it stops at the first member not in b. */
+		bool is_subset(const set &b) const
+		{
+			for(size_t i=0; i<n_words; i++)
+				if(words[i]&~b.words[i])
+					return false;
 			return true;
 		}
 
+		/*
+		 * These functions find the smallest and the largest member of the set.
+		 * @param n: set to the member.
+		 * @return bool: false if the set is empty.
+		 */
+		bool min(long long &n) const
+		{
+			for(size_t i=0; i<n_words; i++)
+			{
+				if(words[i])
+				{
+					n = (long long)((uint64_t)range_start + 64*i + __builtin_ctzll(words[i]));
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool max(long long &n) const
+		{
+			for(size_t i=n_words; i>0; i--)
+			{
+				if(words[i-1])
+				{
+					n = (long long)((uint64_t)range_start + 64*(i-1) + 63-__builtin_clzll(words[i-1]));
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/*
+		 * These functions do the operations in place, the current set is replaced by the result.
+		 * They do not allocate any memory.
+		 * @param b: the other set of the operation.
+		 * @return set&: the current set.
+		 */
+		set& union_with(const set &b)
+		{
+			run_kernel(kernel_or, words, words, b.words, n_words);
+			return *this;
+		}
+
+		set& intersect_with(const set &b)
+		{
+			run_kernel(kernel_and, words, words, b.words, n_words);
+			return *this;
+		}
+
+		/* current set becomes A-B. */
+		set& subtract(const set &b)
+		{
+			run_kernel(kernel_andnot, words, words, b.words, n_words);
+			return *this;
+		}
+
+		set& symmetric_subtract_with(const set &b)
+		{
+			run_kernel(kernel_xor, words, words, b.words, n_words);
+			return *this;
+		}
+
 		/*
 		 * This function takes the union of a set with the current set.
 		 * @param b: the set with which the union operation is to be done.
 		 * @return c: the set formed after the union operation.
+		 * If b is a temporary, its words are reused for the result instead of allocating new ones.
 		 */
-		set set_union(set b)
+		set set_union(const set &b) const
 		{
 			set c;
 
-			/* for each number in range check if it is present in b or in current set, then add. */
-			for(int i=range_start; i<=range_end; i++)
-			{
-				if(b.contains(i) || contains(i))
-					c.add(i);
-			}
+			/* a number is in c if it is present in b or in current set. */
+			run_kernel(kernel_or, c.words, words, b.words, n_words);
 
 			return c;
 		}
 
+		set set_union(set &&b) const
+		{
+			return std::move(b.union_with(*this));
+		}
+
 		/*
 		 * This function takes the intersection of a set with the current set.
 		 * @param b: the set with which the intersection operation is to be done.
 		 * @return c: the set formed after the intersection operation.
+		 * If b is a temporary, its words are reused for the result instead of allocating new ones.
 		 */
-		set set_intersection(set b)
+		set set_intersection(const set &b) const
 		{
 			set c;
 
-			/* for each number in range check if it is present in b and and in the current set, then add. */
-			for(int i=range_start; i<=range_end; i++)
-			{
-				if(b.contains(i) && contains(i))
-					c.add(i);
-			}
+			/* a number is in c if it is present in b and in the current set. */
+			run_kernel(kernel_and, c.words, words, b.words, n_words);
 
 			return c;
 		}
 
+		set set_intersection(set &&b) const
+		{
+			return std::move(b.intersect_with(*this));
+		}
+
 		/*
 		 * This function takes the difference of a set with the current set (A-B).
 		 * @param b: the set with which the difference operation is to be done (B).
 		 * @return c: the set formed after the difference operation (A-B).
+		 * If b is a temporary, its words are reused for the result instead of allocating new ones.
 		 */
-		set set_difference(set b)
+		set set_difference(const set &b) const
 		{
 			set c;
 
-			/* for each member, checking if it is present in current set, and not in set b. */
-			for(int i=range_start; i<=range_end; i++)
-				if(contains(i) && !b.contains(i))
-					c.add(i);
+			/* a number is in c if it is present in current set, and not in set b. */
+			run_kernel(kernel_andnot, c.words, words, b.words, n_words);
 
 			return c;
 		}
 
+		set set_difference(set &&b) const
+		{
+			/* b is overwritten word by word with A-B. */
+			run_kernel(kernel_andnot, b.words, words, b.words, n_words);
+			return std::move(b);
+		}
+
 		/*
 		 * This function takes the set difference of two sets.
 		 * @param b: the set with which the set difference operation is to be done.
 		 * @return c: the set formed after the set difference operation.
+		 * If b is a temporary, its words are reused for the result instead of allocating new ones.
+		 */
+		set set_set_difference(const set &b) const
+		{
+			set c;
+
+			/* a number is in c if it is present in exactly one of the two sets. */
+			run_kernel(kernel_xor, c.words, words, b.words, n_words);
+
+			return c;
+		}
+
+		set set_set_difference(set &&b) const
+		{
+			return std::move(b.symmetric_subtract_with(*this));
+		}
+};
+
+/* Each container holds the numbers of one block of 2^16 numbers. */
+#define CONTAINER_BITS 16
+#define CONTAINER_WORDS 1024
+
+/* An array container holds at most this many numbers, larger ones are bitmaps. */
+#define ARRAY_MAX 4096
+
+#define ARRAY_CONTAINER 0
+#define BITMAP_CONTAINER 1
+#define RUN_CONTAINER 2
+
+/*
+ * This class stores the members of one block of 2^16 numbers, by their lower 16 bits.
+ * @data-member type: ARRAY_CONTAINER, BITMAP_CONTAINER or RUN_CONTAINER.
+ * @data-member card: number of members.
+ * @data-member values: the sorted members of an array, or the start and length-1 of each run.
+ * @data-member bits: the 1024 words of a bitmap.
+ */
+class container
+{
+	public:
+		int type;
+		int card;
+		vector<uint16_t> values;
+		vector<uint64_t> bits;
+
+		container()
+		{
+			type = ARRAY_CONTAINER;
+			card = 0;
+		}
+
+		/* This function writes the members of the container as a bitmap of 1024 words. */
+		void to_bitmap(uint64_t *w) const
+		{
+			if(type==BITMAP_CONTAINER)
+			{
+				memcpy(w, bits.data(), CONTAINER_WORDS*sizeof(uint64_t));
+				return;
+			}
+
+			memset(w, 0, CONTAINER_WORDS*sizeof(uint64_t));
+			if(type==ARRAY_CONTAINER)
+			{
+				for(size_t i=0; i<values.size(); i++)
+					w[values[i]>>6] |= (uint64_t)1<<(values[i]&63);
+				return;
+			}
+
+			for(size_t r=0; r<values.size(); r+=2)
+			{
+				uint32_t start = values[r], end = start+values[r+1];
+				for(uint32_t x=start; x<=end; x++)
+					w[x>>6] |= (uint64_t)1<<(x&63);
+			}
+		}
+
+		/*
+		 * This function sets the container from a bitmap of 1024 words.
+		 * The smallest of the three forms is chosen for it.
 		 */
-		set set_set_difference(set b)
+		void from_bitmap(const uint64_t *w)
+		{
+			int count = 0, runs = 0;
+			uint64_t previous = 0;
+			for(int i=0; i<CONTAINER_WORDS; i++)
+			{
+				count += __builtin_popcountll(w[i]);
+
+				/* a run starts at each bit set whose lower neighbour is not set. */
+				runs += __builtin_popcountll(w[i]&~((w[i]<<1)|(previous>>63)));
+				previous = w[i];
+			}
+
+			card = count;
+			values = vector<uint16_t>();
+			bits = vector<uint64_t>();
+
+			size_t array_bytes = 2*(size_t)count, run_bytes = 4*(size_t)runs;
+			size_t bitmap_bytes = CONTAINER_WORDS*sizeof(uint64_t);
+
+			if(run_bytes<array_bytes && run_bytes<bitmap_bytes)
+			{
+				type = RUN_CONTAINER;
+				values.reserve(2*runs);
+				int x = 0;
+				while(x<(1<<CONTAINER_BITS))
+				{
+					if(!((w[x>>6]>>(x&63))&1))
+					{
+						x++;
+						continue;
+					}
+					int start = x;
+					while(x<(1<<CONTAINER_BITS) && ((w[x>>6]>>(x&63))&1))
+						x++;
+					values.push_back(start);
+					values.push_back(x-1-start);
+				}
+			}
+			else if(count<=ARRAY_MAX)
+			{
+				type = ARRAY_CONTAINER;
+				values.reserve(count);
+				for(int i=0; i<CONTAINER_WORDS; i++)
+				{
+					for(uint64_t v=w[i]; v; v&=v-1)
+						values.push_back(64*i+__builtin_ctzll(v));
+				}
+			}
+			else
+			{
+				type = BITMAP_CONTAINER;
+				bits.assign(w, w+CONTAINER_WORDS);
+			}
+		}
+
+		/* This function calls f with each member, in increasing order. */
+		template<class F>
+		void for_each(F f) const
+		{
+			if(type==ARRAY_CONTAINER)
+			{
+				for(size_t i=0; i<values.size(); i++)
+					f(values[i]);
+			}
+			else if(type==BITMAP_CONTAINER)
+			{
+				for(int i=0; i<CONTAINER_WORDS; i++)
+				{
+					for(uint64_t v=bits[i]; v; v&=v-1)
+						f(64*i+__builtin_ctzll(v));
+				}
+			}
+			else
+			{
+				for(size_t r=0; r<values.size(); r+=2)
+				{
+					uint32_t start = values[r], end = start+values[r+1];
+					for(uint32_t x=start; x<=end; x++)
+						f(x);
+				}
+			}
+		}
+
+		/*
+		 * This function applies an operation to two containers.
+		 * Two arrays are merged, other containers are combined as bitmaps with the set kernels.
+		 * @return container: the result, in its smallest form.
+		 */
+		template<class OP>
+		static container combine(const container &a, const container &b, kernel_fn kernel)
+		{
+			container c;
+			if(a.type==ARRAY_CONTAINER && b.type==ARRAY_CONTAINER)
+			{
+				/* OP tells which of a only, b only and both members are kept. */
+				bool keep_a = OP::apply(1, 0)&1, keep_b = OP::apply(0, 1)&1, keep_both = OP::apply(1, 1)&1;
+				size_t i = 0, j = 0;
+				while(i<a.values.size() || j<b.values.size())
+				{
+					if(j==b.values.size() || (i<a.values.size() && a.values[i]<b.values[j]))
+					{
+						if(keep_a)
+							c.values.push_back(a.values[i]);
+						i++;
+					}
+					else if(i==a.values.size() || b.values[j]<a.values[i])
+					{
+						if(keep_b)
+							c.values.push_back(b.values[j]);
+						j++;
+					}
+					else
+					{
+						if(keep_both)
+							c.values.push_back(a.values[i]);
+						i++;
+						j++;
+					}
+				}
+				c.card = c.values.size();
+				if(c.card<=ARRAY_MAX)
+					return c;
+			}
+
+			uint64_t x[CONTAINER_WORDS], y[CONTAINER_WORDS];
+			a.to_bitmap(x);
+			b.to_bitmap(y);
+			kernel(x, x, y, CONTAINER_WORDS);
+			c.from_bitmap(x);
+			return c;
+		}
+};
+
+/*
+ * This class implements the set for sparse universes, its memory depends on the members
+ * and not on the length of the range.
+ * The range is cut into blocks of 2^16 numbers, and each block that has members is kept
+ * in a container, as an array, a bitmap or a list of runs.
+ * @data-member keys: the sorted block numbers that have members.
+ * @data-member containers: the container of each block in keys.
+ */
+class sparse_set
+{
+	vector<uint64_t> keys;
+	vector<container> containers;
+
+	/*
+	 * This function applies an operation to two sets, block by block.
+	 * OP tells if a block present in only one of the sets is kept.
+	 */
+	template<class OP>
+	sparse_set combine(const sparse_set &b, kernel_fn kernel) const
+	{
+		sparse_set c;
+		bool keep_a = OP::apply(1, 0)&1, keep_b = OP::apply(0, 1)&1;
+		size_t i = 0, j = 0;
+		while(i<keys.size() || j<b.keys.size())
+		{
+			if(j==b.keys.size() || (i<keys.size() && keys[i]<b.keys[j]))
+			{
+				if(keep_a)
+				{
+					c.keys.push_back(keys[i]);
+					c.containers.push_back(containers[i]);
+				}
+				i++;
+			}
+			else if(i==keys.size() || b.keys[j]<keys[i])
+			{
+				if(keep_b)
+				{
+					c.keys.push_back(b.keys[j]);
+					c.containers.push_back(b.containers[j]);
+				}
+				j++;
+			}
+			else
+			{
+				container r = container::combine<OP>(containers[i], b.containers[j], kernel);
+				if(r.card>0)
+				{
+					c.keys.push_back(keys[i]);
+					c.containers.push_back(std::move(r));
+				}
+				i++;
+				j++;
+			}
+		}
+		return c;
+	}
+
+	/*
+	 * This function counts the members of the result of an operation, one block at a time,
+	 * without making the whole result.
+	 */
+	template<class OP>
+	uint64_t combine_cardinality(const sparse_set &b, kernel_fn kernel) const
+	{
+		uint64_t count = 0;
+		bool keep_a = OP::apply(1, 0)&1, keep_b = OP::apply(0, 1)&1;
+		size_t i = 0, j = 0;
+		while(i<keys.size() || j<b.keys.size())
+		{
+			if(j==b.keys.size() || (i<keys.size() && keys[i]<b.keys[j]))
+			{
+				if(keep_a)
+					count += containers[i].card;
+				i++;
+			}
+			else if(i==keys.size() || b.keys[j]<keys[i])
+			{
+				if(keep_b)
+					count += b.containers[j].card;
+				j++;
+			}
+			else
+			{
+				count += container::combine<OP>(containers[i], b.containers[j], kernel).card;
+				i++;
+				j++;
+			}
+		}
+		return count;
+	}
+
+	public:
+		/* This function changes each container to its smallest form, such as runs. */
+		void optimize()
+		{
+			for(size_t k=0; k<containers.size(); k++)
+			{
+				/* an array is kept by from_bitmap() unless its runs take less memory, it is not rebuilt. */
+				const container &c = containers[k];
+				if(c.type==ARRAY_CONTAINER)
+				{
+					size_t runs = c.card>0;
+					for(int i=1; i<c.card; i++)
+						runs += c.values[i]!=c.values[i-1]+1;
+					if(2*runs>=(size_t)c.card)
+						continue;
+				}
+
+				uint64_t w[CONTAINER_WORDS];
+				containers[k].to_bitmap(w);
+				containers[k].from_bitmap(w);
+			}
+		}
+
+		sparse_set set_union(const sparse_set &b) const
+		{
+			return combine<op_or>(b, kernel_or);
+		}
+
+		sparse_set set_intersection(const sparse_set &b) const
+		{
+			return combine<op_and>(b, kernel_and);
+		}
+
+		sparse_set set_difference(const sparse_set &b) const
+		{
+			return combine<op_andnot>(b, kernel_andnot);
+		}
+
+		sparse_set set_set_difference(const sparse_set &b) const
+		{
+			return combine<op_xor>(b, kernel_xor);
+		}
+
+		/* the operations in place, the current set is replaced by the result. */
+		sparse_set& union_with(const sparse_set &b)
+		{
+			return *this = set_union(b);
+		}
+
+		sparse_set& intersect_with(const sparse_set &b)
+		{
+			return *this = set_intersection(b);
+		}
+
+		sparse_set& subtract(const sparse_set &b)
+		{
+			return *this = set_difference(b);
+		}
+
+		sparse_set& symmetric_subtract_with(const sparse_set &b)
+		{
+			return *this = set_set_difference(b);
+		}
+
+		/* the blocks of the set, for the functions that save and load it. */
+		size_t container_count() const
+		{
+			return keys.size();
+		}
+
+		uint64_t key(size_t k) const
+		{
+			return keys[k];
+		}
+
+		const container& get_container(size_t k) const
+		{
+			return containers[k];
+		}
+
+		/* This function adds a block after all the blocks of the set. */
+		void append(uint64_t key, const container &c)
+		{
+			keys.push_back(key);
+			containers.push_back(c);
+		}
+
+		/*
+		 * This function replaces the members of the set, the blocks are built in increasing order.
+		 * @param numbers: the offsets of the members from range_start, each with its position in the
+		 * input, sorted and without duplicate offsets.
+		 */
+		void assign_sorted(const vector<pair<uint64_t, uint64_t> > &numbers)
+		{
+			keys.clear();
+			containers.clear();
+			for(size_t i=0, j; i<numbers.size(); i=j)
+			{
+				uint64_t key = numbers[i].first>>CONTAINER_BITS;
+				for(j=i+1; j<numbers.size() && (numbers[j].first>>CONTAINER_BITS)==key; j++);
+
+				keys.push_back(key);
+				containers.push_back(container());
+				container &c = containers.back();
+				c.card = j-i;
+				if(c.card>ARRAY_MAX)
+				{
+					c.type = BITMAP_CONTAINER;
+					c.bits.assign(CONTAINER_WORDS, 0);
+					for(size_t k=i; k<j; k++)
+						c.bits[(numbers[k].first>>6)&(CONTAINER_WORDS-1)] |= (uint64_t)1<<(numbers[k].first&63);
+				}
+				else
+				{
+					c.values.resize(j-i);
+					for(size_t k=i; k<j; k++)
+						c.values[k-i] = numbers[k].first&0xFFFF;
+				}
+			}
+		}
+
+		/* the counting functions of set, for sparse sets. */
+		uint64_t cardinality() const
+		{
+			uint64_t count = 0;
+			for(size_t k=0; k<containers.size(); k++)
+				count += containers[k].card;
+			return count;
+		}
+
+		uint64_t union_cardinality(const sparse_set &b) const
+		{
+			return combine_cardinality<op_or>(b, kernel_or);
+		}
+
+		uint64_t intersection_cardinality(const sparse_set &b) const
+		{
+			return combine_cardinality<op_and>(b, kernel_and);
+		}
+
+		uint64_t difference_cardinality(const sparse_set &b) const
+		{
+			return combine_cardinality<op_andnot>(b, kernel_andnot);
+		}
+
+		uint64_t sym_difference_cardinality(const sparse_set &b) const
+		{
+			return combine_cardinality<op_xor>(b, kernel_xor);
+		}
+
+		double jaccard(const sparse_set &b) const
+		{
+			uint64_t both = intersection_cardinality(b), any = union_cardinality(b);
+			return any ? (double)both/any : 1.0;
+		}
+
+		bool is_subset(const sparse_set &b) const
+		{
+			return difference_cardinality(b)==0;
+		}
+
+		bool min(long long &n) const
+		{
+			if(keys.empty())
+				return false;
+
+			uint32_t low = 0;
+			bool found = false;
+			containers[0].for_each([&](uint32_t x) { if(!found) { low = x; found = true; } });
+			n = (long long)((uint64_t)range_start + (keys[0]<<CONTAINER_BITS)+low);
+			return true;
+		}
+
+		bool max(long long &n) const
+		{
+			if(keys.empty())
+				return false;
+
+			uint32_t high = 0;
+			containers.back().for_each([&](uint32_t x) { high = x; });
+			n = (long long)((uint64_t)range_start + (keys.back()<<CONTAINER_BITS)+high);
+			return true;
+		}
+
+		/* This function calls f with the offset from range_start of each member, in increasing order. */
+		template<class F>
+		void for_each(F f) const
+		{
+			for(size_t k=0; k<keys.size(); k++)
+			{
+				uint64_t base = keys[k]<<CONTAINER_BITS;
+				containers[k].for_each([&](uint32_t low) { f(base+low); });
+			}
+		}
+};
+
+/*
+ * This function parses a number of the range, with an optional minus sign.
+ * @param range: the range argument in the console.
+ * @param i: the position of the number, moved past it.
+ * @param n: set to the number.
+ * @return bool: false if there are no digits, or if the number does not fit in 64 bits.
+ */
+bool parse_range_number(const char *range, int &i, long long &n)
+{
+	bool negative = range[i]=='-';
+	if(negative)
+		i++;
+
+	int first = i;
+	n = 0;
+	while(range[i]>='0' && range[i]<='9')
+	{
+		int d = range[i]-'0';
+
+		/* if the number does not fit in 64 bits, the negative numbers are built downwards. */
+		if(negative ? n<(LLONG_MIN+d)/10 : n>(LLONG_MAX-d)/10)
+			return false;
+
+		n = negative ? n*10-d : n*10+d;
+		i++;
+	}
+	return i>first;
+}
+
+/*
+ * This function parses the range provided in the console to get the range values.
+ * The range is start-end, and both may be negative, as in -1000--10 or -5-5.
+ * @param range: the range argument in the console.
+ * @return void: it just sets the range global variables.
+ */
+void parse_range(char *range)
+{
+	int i = 0;
+
+	/*
+	 * Error in case of invalid ranges such as,
+	 * 		When it contains invalid characters, or numbers that do not fit in 64 bits.
+	 *		When no start or end range is provided. (1000, 1000-)
+	 * 		When end index is smaller than start index. (3000-1000)
+	 */
+	bool valid = parse_range_number(range, i, range_start) && range[i]=='-';
+	if(valid)
+	{
+		i++;
+		valid = parse_range_number(range, i, range_end) && range[i]=='\0' && range_end>=range_start;
+	}
+
+	if(!valid)
+	{
+		cout<<"ERROR: Invalid range!\n";
+		exit(0);
+	}
+}
+
+
+/*
+ * This function parses the argument for the desired operation to perform.
+ * The operations 1 to 4 make a set. The others are queries that write one answer:
+ * the cardinality of the result of an operation, the Jaccard similarity, whether the first set
+ * is a subset of the second (1 or 0), and the cardinality, min and max of the first set.
+ * convert takes a single input file, and writes its set.
+ * @param op: command line argument.
+ * operation_code() returns the number of the operation, 0 if it is not valid,
+ * parse_operation() sets it as the operation to perform.
+ */
+int operation_code(char *op)
+{
+	int len = strlen(op);
+
+	/* changing the upper case characters to lower case to support case-insensitiveness. */
+	for(int i=0; i<len; i++)
+	{
+		if((!(op[i]>='a' && op[i]<='z')) && op[i]!='_')
+			op[i] = op[i]^' ';
+	}
+
+	/* checking for the desired operation. */
+	if(strcmp(op, "union")==0)
+		return 1;
+	else if(strcmp(op, "intersection")==0)
+		return 2;
+	else if(strcmp(op, "difference")==0)
+		return 3;
+	else if(strcmp(op, "sym_difference")==0)
+		return 4;
+
+	/* the queries, they write a single answer instead of a set. */
+	else if(strcmp(op, "union_cardinality")==0)
+		return 5;
+	else if(strcmp(op, "intersection_cardinality")==0)
+		return 6;
+	else if(strcmp(op, "difference_cardinality")==0)
+		return 7;
+	else if(strcmp(op, "sym_difference_cardinality")==0)
+		return 8;
+	else if(strcmp(op, "jaccard")==0)
+		return 9;
+	else if(strcmp(op, "subset")==0)
+		return 10;
+	else if(strcmp(op, "cardinality")==0)
+		return 11;
+	else if(strcmp(op, "min")==0)
+		return 12;
+	else if(strcmp(op, "max")==0)
+		return 13;
+
+	/* writes the set of a single input file, to change it between text and binary. */
+	else if(strcmp(op, "convert")==0)
+		return 14;
+
+	/* No valid operation found. */
+	return 0;
+}
+
+void parse_operation(char *op)
+{
+	operation = operation_code(op);
+
+	/* No valid operation found. */
+	if(operation==0)
+	{
+		cout<<"ERROR: Invalid Operation!\n";
+		exit(0);
+	}
+}
+
+
+/*
+ * This function parses an option, an argument starting with "--".
+ * @param opt: the option.
+ * 	--dense: the sets are stored as bitmaps of the range.
+ * 	--sparse: the sets are stored in containers, for ranges much larger than the input.
+ * 	--sorted: the input files are sorted, and are merged without making sets.
+ * 	--binary: the output set is written as a binary file, that can be used as an input.
+ * 	--no-verify: the checksums of binary input files are not checked.
+ * 	--first-touch: the pages of the sets are placed by the threads that work on them.
+ * 	--stats: the time and the work of each phase are reported to stderr.
+ * 	--kway: the union or the intersection of any number of input files.
+ */
+void parse_option(char *opt)
+{
+	if(strcmp(opt, "--sorted")==0)
+		sorted_inputs = true;
+	else if(strcmp(opt, "--binary")==0)
+		binary_output = true;
+	else if(strcmp(opt, "--no-verify")==0)
+		verify_checksums = false;
+	else if(strcmp(opt, "--dense")==0)
+		backend = DENSE_BACKEND;
+	else if(strcmp(opt, "--sparse")==0)
+		backend = SPARSE_BACKEND;
+	else if(strcmp(opt, "--first-touch")==0)
+		first_touch = true;
+	else if(strcmp(opt, "--stats")==0)
+		show_stats = true;
+	else if(strcmp(opt, "--kway")==0)
+		kway = true;
+	else
+	{
+		cout<<"ERROR: Invalid option "<<opt<<"!\n";
+		exit(0);
+	}
+}
+
+/*
+ * This function parses the options that take a value, the argument that follows them.
+ * 	--expr "expression": the expression evaluated over the input files.
+ * 	--batch script: the file of commands run by the batch mode.
+ * 	--cache-mb n: the memory in MB for the sets kept by the batch mode, or loaded at a time by --kway.
+ * 	--threads n: the number of threads used.
+ * 	--delta result: the binary file of the result, updated with the deltas of the inputs.
+ * 	--stats-json file: the report of --stats is written to the file as JSON.
+ * 	--at-least k: the numbers present in at least k of any number of input files.
+ * @param i: the position of the argument, moved to the value of the option.
+ * @return bool: true if the argument is an option that takes a value.
+ */
+bool parse_value_option(int &i, int args, char **argc)
+{
+	if(strcmp(argc[i], "--expr")!=0 && strcmp(argc[i], "--batch")!=0 && strcmp(argc[i], "--cache-mb")!=0
+		&& strcmp(argc[i], "--threads")!=0 && strcmp(argc[i], "--delta")!=0
+		&& strcmp(argc[i], "--stats-json")!=0 && strcmp(argc[i], "--at-least")!=0)
+		return false;
+
+	if(i+1==args)
+	{
+		cout<<"ERROR: Invalid arguments!\n";
+		exit(0);
+	}
+
+	if(strcmp(argc[i], "--expr")==0)
+		expression = argc[i+1];
+	else if(strcmp(argc[i], "--batch")==0)
+		batch_file = argc[i+1];
+	else if(strcmp(argc[i], "--delta")==0)
+		delta_result = argc[i+1];
+	else if(strcmp(argc[i], "--stats-json")==0)
+		stats_file = argc[i+1];
+	else
+	{
+		char *end;
+		long long n = strtoll(argc[i+1], &end, 10);
+		if(*end!='\0' || n<=0 || (strcmp(argc[i], "--threads")==0 && n>1024))
+		{
+			cout<<"ERROR: Invalid arguments!\n";
+			exit(0);
+		}
+
+		if(strcmp(argc[i], "--threads")==0)
+			thread_count = n;
+		else if(strcmp(argc[i], "--at-least")==0)
+			at_least = n;
+		else
+			cache_budget = (size_t)n<<20;
+	}
+
+	i++;
+	return true;
+}
+
+/*
+ * This function parses the arguments passed through the console.
+ * The options may be placed anywhere, the other arguments are taken in order.
+ * With --expr "expression" or --at-least k, the arguments are the range, the input files and the output file.
+ * With --kway, the arguments are the range, union or intersection, the input files and the output file.
+ * With --batch script, the only argument is the range.
+ * @param args: number of arguments passed.
+ * @param argc: argument list passed as pointer to array of characters.
+ * @return int: the number of arguments that are not options, including the program name.
+ */
+int parse_arguments(int args, char **argc)
+{
+	int given = 1;
+
+	/* counting the arguments that are not options. */
+	for(int i=1; i<args; i++)
+	{
+		if(parse_value_option(i, args, argc))
+			continue;
+		if(strcmp(argc[i], "--kway")==0)
+			kway = true;
+		if(!(strncmp(argc[i], "--", 2)==0 && argc[i][2]!='\0'))
+			given++;
+	}
+
+	/* a batch is only given the range, the commands are in the script. */
+	if(batch_file!="")
+	{
+		for(int i=1; i<args; i++)
+		{
+			if(parse_value_option(i, args, argc))
+				continue;
+			if(strncmp(argc[i], "--", 2)==0 && argc[i][2]!='\0')
+				parse_option(argc[i]);
+			else if(given==2)
+				parse_range(argc[i]);
+		}
+
+		if(given!=2)
+		{
+			cout<<"ERROR: Invalid arguments!\n";
+			exit(0);
+		}
+		return given;
+	}
+
+	/* an expression or a threshold is given the range, the input files and the output file. */
+	bool with_operation = kway && at_least==0;
+	if(expression!="" || kway || at_least>0)
+	{
+		if(given<(with_operation ? 5 : 4))
+		{
+			cout<<"ERROR: Invalid arguments!\n";
+			exit(0);
+		}
+
+		given = 1;
+		for(int i=1; i<args; i++)
+		{
+			if(parse_value_option(i, args, argc))
+				continue;
+			else if(strncmp(argc[i], "--", 2)==0 && argc[i][2]!='\0')
+				parse_option(argc[i]);
+			else if(++given==2)
+				parse_range(argc[i]);
+			else if(with_operation && given==3)
+			{
+				/* only the union and the intersection are taken over many files. */
+				parse_operation(argc[i]);
+				if(operation>2)
+				{
+					cout<<"ERROR: Invalid Operation!\n";
+					exit(0);
+				}
+			}
+			else
+				input_files.push_back(argc[i]);
+		}
+
+		output_file = input_files.back();
+		input_files.pop_back();
+		return given;
+	}
+
+	/* Error if more than five arguments. */
+	if(given>6)
+	{
+		cout<<"ERROR: Invalid arguments!\n";
+		exit(0);
+	}
+
+	given = 1;
+	for(int i=1; i<args; i++)
+	{
+		if(parse_value_option(i, args, argc))
+			continue;
+		if(strncmp(argc[i], "--", 2)==0 && argc[i][2]!='\0')
+		{
+			parse_option(argc[i]);
+			continue;
+		}
+		given++;
+
+		/* Parsing the range argument. */
+		if(given==2)
+			parse_range(argc[i]);
+
+		/* Parsing the operation argument. */
+		if(given==3)
+			parse_operation(argc[i]);
+
+		/* First input file. */
+		if(given==4)
+			input_file1 = (string)argc[i];
+
+		/* Second input file, or the output file of convert. */
+		if(given==5 && operation==14)
+			output_file = (string)argc[i];
+		else if(given==5)
+			input_file2 = (string)argc[i];
+
+		/* Output file name. */
+		if(given==6 && operation==14)
+		{
+			cout<<"ERROR: Invalid arguments!\n";
+			exit(0);
+		}
+		if(given==6)
+			output_file = (string)argc[i];
+	}
+
+	return given;
+}
+
+/* checks for the white space characters skipped by fscanf(). */
+static inline bool is_space(char ch)
+{
+	return ch==' ' || ch=='\n' || ch=='\t' || ch=='\r' || ch=='\v' || ch=='\f';
+}
+
+static inline bool is_digit(char ch)
+{
+	return (unsigned char)(ch-'0')<=9;
+}
+
+/*
+ * This function converts k (1 to 8) digit characters to their value, all at once (SWAR).
+ * The 8 bytes at p must be readable.
+ */
+static inline uint64_t swar_digits(const char *p, int k)
+{
+	uint64_t chunk;
+	memcpy(&chunk, p, 8);
+
+	/* moving the k digits to the top of the word, the lower bytes become leading zeros. */
+	chunk <<= 8*(8-k);
+
+	/* combining pairs of digits, then pairs of pairs, then the two halves. */
+	chunk = ((chunk&0x0F0F0F0F0F0F0F0FULL)*2561)>>8;
+	chunk = ((chunk&0x00FF00FF00FF00FFULL)*6553601)>>16;
+	return ((chunk&0x0000FFFF0000FFFFULL)*42949672960001ULL)>>32;
+}
+
+#ifdef SET_X86_KERNELS
+/*
+ * This function counts the digit characters at the start of the 16 bytes at p, with SSE2.
+ * @return int: length of the run of digits, 16 if all of them are digits.
+ */
+static inline __attribute__((target("sse2"))) int digit_run(const char *p)
+{
+	__m128i v = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)p), _mm_set1_epi8('0'));
+
+	/* a byte is a digit if byte-'0' is at most 9 as an unsigned number. */
+	__m128i digit = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(9)), v);
+	unsigned mask = _mm_movemask_epi8(digit);
+	return __builtin_ctz(~mask);
+}
+#endif
+
+/*
+ * This function parses the integers in a block of text, and passes each of them to the sink.
+ * The sink gets number(value) for every integer, out_of_range() for an integer that does not
+ * fit in 64 bits, and invalid() for text that is not one.
+ * @param p, end: the text to be parsed, a number is not split across blocks.
+ */
+template<class SINK>
+void parse_numbers(const char *p, const char *end, SINK &sink)
+{
+	while(p<end)
+	{
+		/* skipping the white spaces between numbers. */
+		if(is_space(*p))
+		{
+			p++;
+			continue;
+		}
+
+		/* optional sign of the number. */
+		bool negative = false;
+		if(*p=='-' || *p=='+')
+		{
+			negative = *p=='-';
+			p++;
+		}
+
+		uint64_t value = 0;
+		int k = 0;
+
+#ifdef SET_X86_KERNELS
+		/* away from the end of the text, the digits are found and converted in blocks. */
+		if(end-p>=16)
+		{
+			k = digit_run(p);
+			if(k<=8)
+				value = k ? swar_digits(p, k) : 0;
+			else if(k<16)
+				value = swar_digits(p, k-8)*100000000LL + swar_digits(p+k-8, 8);
+		}
+#endif
+		/* near the end of the text, or for very long numbers, one digit at a time. */
+		if(k==0 || k==16)
+		{
+			k = 0;
+			value = 0;
+			while(p+k<end && is_digit(p[k]))
+			{
+				if(k<19)
+					value = value*10 + p[k]-'0';
+				k++;
+			}
+		}
+
+		p += k;
+
+		/* a number must be followed by a white space or the end of the text. */
+		if(k==0 || (p<end && !is_space(*p)))
+		{
+			sink.invalid();
+			return;
+		}
+
+		/* the negative numbers go one further than the positive ones. */
+		if(k>19 || value>(uint64_t)LLONG_MAX+negative)
+			sink.out_of_range();
+		else
+			sink.number(negative ? (long long)(0-value) : (long long)value);
+	}
+}
+
+/* Errors found while loading a set from a file. */
+#define LOAD_OUT_OF_RANGE 1
+#define LOAD_DUPLICATE 2
+#define LOAD_INVALID 3
+
+/*
+ * This function reports an error found while loading a set, and exits.
+ * @param filename: the file of the set.
+ * @param error: LOAD_OUT_OF_RANGE, LOAD_DUPLICATE or LOAD_INVALID.
+ * @param num: the number duplicated.
+ */
+void load_error(const string &filename, int error, long long num)
+{
+	/* If numbers out of range. */
+	if(error==LOAD_OUT_OF_RANGE)
+		cout<<"ERROR: number not in the specified range.\n";
+
+	/* If duplicate number found. */
+	else if(error==LOAD_DUPLICATE)
+	{
+		cout<<"ERROR: Duplicate number found in file "<<filename<<"."<<endl;
+		cout<<"The number duplicated is: "<<num<<endl;
+	}
+	else
+		cout<<"ERROR: Invalid number found in file "<<filename<<".\n";
+	exit(0);
+}
+
+/* This class adds the parsed numbers to a set, and reports the errors of create_set(). */
+template<class SET>
+class set_loader
+{
+	const string &filename;
+	SET *s;
+
+	public:
+		set_loader(const string &name, SET *target) : filename(name), s(target) {}
+
+		void number(long long num)
+		{
+			if(num<range_start || num>range_end)
+				out_of_range();
+
+			/* Adding the numbers to the set. */
+			if(!s->add(num))
+				load_error(filename, LOAD_DUPLICATE, num);
+		}
+
+		void out_of_range()
+		{
+			load_error(filename, LOAD_OUT_OF_RANGE, 0);
+		}
+
+		void invalid()
+		{
+			load_error(filename, LOAD_INVALID, 0);
+		}
+};
+
+/*
+ * This class collects the parsed numbers of a sparse set as offsets from range_start, with their
+ * positions in the file, and reports the errors of create_set() in the order of set_loader.
+ */
+class sparse_loader
+{
+	const string &filename;
+
+	public:
+		vector<pair<uint64_t, uint64_t> > numbers;
+
+		sparse_loader(const string &name) : filename(name) {}
+
+		void number(long long num)
+		{
+			if(num<range_start || num>range_end)
+				out_of_range();
+			numbers.push_back(make_pair((uint64_t)num-(uint64_t)range_start, (uint64_t)numbers.size()));
+		}
+
+		/*
+		 * This function sorts the numbers, and reports the duplicate number whose second copy
+		 * comes first in the file, if there is one.
+		 */
+		void sort_numbers()
+		{
+			sort(numbers.begin(), numbers.end());
+
+			size_t k = 0;
+			for(size_t i=1; i<numbers.size(); i++)
+				if(numbers[i].first==numbers[i-1].first && (k==0 || numbers[i].second<numbers[k].second))
+					k = i;
+			if(k>0)
+				load_error(filename, LOAD_DUPLICATE, (long long)((uint64_t)range_start+numbers[k].first));
+		}
+
+		/* a duplicate number before the error is reported first. */
+		void out_of_range()
+		{
+			sort_numbers();
+			load_error(filename, LOAD_OUT_OF_RANGE, 0);
+		}
+
+		void invalid()
+		{
+			sort_numbers();
+			load_error(filename, LOAD_INVALID, 0);
+		}
+};
+
+/* size of the buffer used when the input can not be mapped. */
+#define READ_BUFFER_SIZE (1<<20)
+
+/*
+ * An opened input file. The name - is the standard input.
+ * Files compressed with gzip or zstd are decoded by "gzip -dc" or "zstd -dc" in a child process,
+ * and fd reads the decoded text from a pipe, so nothing is written to the disk.
+ * @data fd: the file, or the pipe of the decoder.
+ * @data mappable: fd is a regular file that can be mapped.
+ * @data prefix: the bytes already read from a pipe to find its format, they come before fd.
+ * @data decoder: the process of the decoder, or 0.
+ * @data feeder: writes the bytes of a compressed pipe to the decoder.
+ */
+struct input_source
+{
+	int fd;
+	bool mappable;
+	string prefix;
+	pid_t decoder;
+	thread feeder;
+};
+
+/*
+ * This function writes a block of memory to a file, retrying partial writes.
+ * @return bool: false if the write failed.
+ */
+bool write_all(int fd, const char *p, size_t n)
+{
+	while(n>0)
+	{
+		ssize_t done = write(fd, p, n);
+		if(done<0)
+			return false;
+		p += done;
+		n -= done;
+	}
+	return true;
+}
+
+/*
+ * This function opens a file for writing, the name - is the standard output.
+ * @return int: the file, or -1 if it could not be opened.
+ */
+int open_output(const string &filename)
+{
+	if(filename=="-")
+		return dup(1);
+	return open(filename.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+}
+
+/*
+ * This function opens an input file, see input_source.
+ * @param filename: name of the file, or - for the standard input.
+ * @param in: the opened input.
+ * @return bool: false if the file could not be opened.
+ */
+bool open_input(const string &filename, input_source &in)
+{
+	in.fd = filename=="-" ? dup(0) : open(filename.c_str(), O_RDONLY|O_CLOEXEC);
+	in.mappable = false;
+	in.prefix = "";
+	in.decoder = 0;
+	if(in.fd<0)
+		return false;
+
+	/* the format is found from the first bytes, a pipe can not be read again. */
+	struct stat info;
+	bool regular = fstat(in.fd, &info)==0 && S_ISREG(info.st_mode);
+	unsigned char magic[4];
+	ssize_t got = 0;
+	if(regular)
+		got = pread(in.fd, magic, 4, 0);
+	else
+	{
+		while(got<4)
+		{
+			ssize_t k = read(in.fd, magic+got, 4-got);
+			if(k<=0)
+				break;
+			got += k;
+		}
+		in.prefix.assign((const char*)magic, max(got, (ssize_t)0));
+	}
+
+	const char *decoder = NULL;
+	if(got>=2 && magic[0]==0x1f && magic[1]==0x8b)
+		decoder = "gzip";
+	else if(got==4 && magic[0]==0x28 && magic[1]==0xb5 && magic[2]==0x2f && magic[3]==0xfd)
+		decoder = "zstd";
+
+	if(decoder==NULL)
+	{
+		in.mappable = regular;
+		return true;
+	}
+
+	/* the decoder reads the file, or a pipe fed with the bytes of the input pipe. */
+	int output[2], input[2] = {in.fd, -1};
+	if(pipe2(output, O_CLOEXEC)!=0 || (!regular && pipe2(input, O_CLOEXEC)!=0))
+	{
+		cout<<"ERROR: could not read file "<<filename<<".\n";
+		exit(0);
+	}
+
+	in.decoder = fork();
+	if(in.decoder==0)
+	{
+		dup2(input[0], 0);
+		dup2(output[1], 1);
+		execlp(decoder, decoder, "-dc", (char*)NULL);
+		_exit(127);
+	}
+	close(output[1]);
+
+	if(!regular)
+	{
+		close(input[0]);
+		int source = in.fd, sink = input[1];
+		string prefix = in.prefix;
+		in.feeder = thread([source, sink, prefix]()
+		{
+			vector<char> buffer(READ_BUFFER_SIZE);
+			bool open = write_all(sink, prefix.data(), prefix.size());
+			ssize_t got;
+			while(open && (got = read(source, buffer.data(), buffer.size()))>0)
+				open = write_all(sink, buffer.data(), got);
+			close(sink);
+			close(source);
+		});
+		in.prefix = "";
+	}
+	else
+		close(in.fd);
+
+	in.fd = output[0];
+	return true;
+}
+
+/*
+ * This function closes an input file, and checks that its decoder has decoded all of it.
+ * @param filename: name of the file, for the errors.
+ * @param in: the opened input.
+ */
+void close_input(const string &filename, input_source &in)
+{
+	close(in.fd);
+	if(in.feeder.joinable())
+		in.feeder.join();
+
+	if(in.decoder>0)
+	{
+		int status;
+		if(waitpid(in.decoder, &status, 0)<0 || !WIFEXITED(status) || WEXITSTATUS(status)!=0)
+		{
+			cout<<"ERROR: could not decompress file "<<filename<<".\n";
+			exit(0);
+		}
+	}
+}
+
+/* the room before a block read by parse_stream(), for the part of a number cut at the end of the block before. */
+#define READ_CARRY_SIZE 4096
+
+/*
+ * This function parses the numbers of a file that can not be mapped, such as a pipe.
+ * The file is read in large blocks into two buffers. With many threads, one reader thread reads
+ * the next block while the block before it is parsed, and the buffers are handed over between them
+ * under a mutex. A number cut at the end of a block is moved in front of
+ * the next one. Text without white space longer than READ_CARRY_SIZE is parsed in pieces,
+ * it is not a valid number.
+ * @param fd: the opened file.
+ * @param sink: receives the parsed numbers.
+ * @param prefix: the text that comes before the text of fd.
+ */
+template<class SINK>
+void parse_stream(int fd, SINK &sink, const string &prefix = "")
+{
+	vector<char> buffers[2];
+	buffers[0].resize(READ_CARRY_SIZE+READ_BUFFER_SIZE);
+	buffers[1].resize(READ_CARRY_SIZE+READ_BUFFER_SIZE);
+
+	/* a block is filled up to the end of the input, pipes give less at each read. */
+	auto read_block = [fd](char *block)
+	{
+		ssize_t filled = 0;
+		while(filled<READ_BUFFER_SIZE)
+		{
+			ssize_t got = read(fd, block+filled, READ_BUFFER_SIZE-filled);
+			if(got<0)
+				return got;
+			if(got==0)
+				break;
+			filled += got;
+		}
+		return filled;
+	};
+
+	/*
+	 * The reader fills the buffers in turn, ready[b] is true while buffer b holds a block that is
+	 * not parsed yet, of filled[b] bytes. The room for the carry is only written by the parser.
+	 */
+	mutex handoff;
+	condition_variable changed;
+	bool ready[2] = {false, false};
+	ssize_t filled[2] = {0, 0};
+
+	auto reader = [&]()
+	{
+		for(int b=0; ; b^=1)
+		{
+			{
+				unique_lock<mutex> lock(handoff);
+				changed.wait(lock, [&]() { return !ready[b]; });
+			}
+
+			ssize_t got = read_block(buffers[b].data()+READ_CARRY_SIZE);
+			{
+				lock_guard<mutex> lock(handoff);
+				filled[b] = got;
+				ready[b] = true;
+			}
+			changed.notify_all();
+			if(got<=0)
+				return;
+		}
+	};
+
+	int current = 0;
+	size_t carry = prefix.size();
+	memcpy(buffers[0].data()+READ_CARRY_SIZE-carry, prefix.data(), carry);
+
+	/* with a single thread, the blocks are read when they are needed. */
+	bool threaded = usable_threads()>1;
+	thread reading;
+	if(threaded)
+		reading = thread(reader);
+
+	while(true)
+	{
+		ssize_t got;
+		if(threaded)
+		{
+			unique_lock<mutex> lock(handoff);
+			changed.wait(lock, [&]() { return ready[current]; });
+			got = filled[current];
+		}
+		else
+			got = read_block(buffers[current].data()+READ_CARRY_SIZE);
+
+		if(got<0)
+		{
+			cout<<"ERROR: could not read the input.\n";
+			exit(0);
+		}
+
+		char *block = buffers[current].data()+READ_CARRY_SIZE;
+		char *begin = block-carry, *end = block+got;
+
+		/* end of the input, everything left is parsed. */
+		if(got==0)
+		{
+			parse_numbers(begin, end, sink);
+			if(threaded)
+				reading.join();
+			return;
+		}
+
+		/* parsing up to the last white space, the rest may be a part of a number. */
+		char *cut = end;
+		while(cut>begin && !is_space(cut[-1]))
+			cut--;
+		if(end-cut>READ_CARRY_SIZE)
+			cut = end;
+
+		parse_numbers(begin, cut, sink);
+		int next = current^1;
+		carry = end-cut;
+		memcpy(buffers[next].data()+READ_CARRY_SIZE-carry, cut, carry);
+
+		/* the buffer is given back to the reader for the block after the next one. */
+		if(threaded)
+		{
+			{
+				lock_guard<mutex> lock(handoff);
+				ready[current] = false;
+			}
+			changed.notify_all();
+		}
+		current = next;
+	}
+}
+
+/*
+ * This function parses the numbers of an opened input, and closes it.
+ * Regular files are mapped into memory and parsed in place, other files are read in blocks.
+ * @param filename: name of the file.
+ * @param in: the input opened by open_input().
+ * @param sink: receives the parsed numbers.
+ */
+template<class SINK>
+void parse_input(const string &filename, input_source &in, SINK &sink)
+{
+	if(in.mappable)
+	{
+		struct stat info;
+		fstat(in.fd, &info);
+
+		/* an empty file has no numbers. */
+		if(info.st_size==0)
+		{
+			close_input(filename, in);
+			return;
+		}
+
+		void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, in.fd, 0);
+		if(data!=MAP_FAILED)
+		{
+			madvise(data, info.st_size, MADV_SEQUENTIAL);
+			parse_numbers((const char*)data, (const char*)data+info.st_size, sink);
+			munmap(data, info.st_size);
+			close_input(filename, in);
+			return;
+		}
+	}
+
+	/* pipes, devices, compressed files and files that could not be mapped. */
+	parse_stream(in.fd, sink, in.prefix);
+	close_input(filename, in);
+}
+
+/*
+ * This function parses the numbers of a file.
+ * @param filename: name of the file to be read, or - for the standard input.
+ * @param sink: receives the parsed numbers.
+ */
+template<class SINK>
+void parse_file(const string &filename, SINK &sink)
+{
+	input_source in;
+
+	/* Error while opening file. */
+	if(!open_input(filename, in))
+	{
+		cout<<"ERROR: could not open file "<<filename<<".\n";
+		exit(0);
+	}
+
+	parse_input(filename, in, sink);
+}
+
+/*
+ * Binary files hold a set as a header followed by the words of a bitmap, or by the blocks
+ * of a sparse set. The words start 64 bytes into the file, so they can be used in place
+ * from a mapping of the file.
+ * @data magic: "SETBIN1" and a zero byte.
+ * @data kind: BINARY_BITMAP or BINARY_CONTAINERS.
+ * @data range_start, range_end: the range of the set.
+ * @data count: the number of words, or of blocks.
+ * @data payload_bytes: the size of the data after the header, a multiple of 8.
+ * @data checksum: the checksum of the data, see checksum_word().
+ */
+#define BINARY_BITMAP 1
+#define BINARY_CONTAINERS 2
+#define BINARY_HEADER_SIZE 64
+
+struct binary_header
+{
+	char magic[8];
+	uint32_t kind;
+	uint32_t reserved;
+	int64_t range_start;
+	int64_t range_end;
+	uint64_t count;
+	uint64_t payload_bytes;
+	uint64_t checksum;
+	uint64_t padding;
+};
+
+static const char binary_magic[8] = {'S', 'E', 'T', 'B', 'I', 'N', '1', '\0'};
+
+/*
+ * This function gives the part of the checksum of a binary file for one word.
+ * The checksum is the sum of these parts, each part depends on the word and its position,
+ * so a changed word can be patched into the sum without reading the others.
+ * @param w: the word.
+ * @param i: the position of the word in the data.
+ */
+static inline uint64_t checksum_word(uint64_t w, uint64_t i)
+{
+	uint64_t x = w ^ (i*0x9E3779B97F4A7C15ULL);
+	x = (x^(x>>30))*0xBF58476D1CE4E5B9ULL;
+	x = (x^(x>>27))*0x94D049BB133111EBULL;
+	return x^(x>>31);
+}
+
+uint64_t checksum_words(const uint64_t *w, size_t n)
+{
+	uint64_t sum = 0;
+	for(size_t i=0; i<n; i++)
+		sum += checksum_word(w[i], i);
+	return sum;
+}
+
+/*
+ * This function checks if a file is a binary set file, by its magic.
+ * Only regular files are checked, as reading a pipe would take its data.
+ */
+bool is_binary_file(const string &filename)
+{
+	struct stat info;
+	if(stat(filename.c_str(), &info)!=0 || !S_ISREG(info.st_mode))
+		return false;
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if(fd<0)
+		return false;
+
+	char magic[8];
+	bool binary = read(fd, magic, 8)==8 && memcmp(magic, binary_magic, 8)==0;
+	close(fd);
+	return binary;
+}
+
+/*
+ * This function maps a binary set file and checks its header and checksum.
+ * @param filename: name of the file.
+ * @param header: set to the header of the file.
+ * @param map_size: set to the size of the mapping.
+ * @param shared: the changes to the mapping are written to the file.
+ * @return char*: the mapping, the data starts BINARY_HEADER_SIZE bytes into it.
+ */
+char* map_binary(const string &filename, binary_header &header, size_t &map_size, bool shared = false)
+{
+	int fd = open(filename.c_str(), shared ? O_RDWR : O_RDONLY);
+
+	/* Error while opening file. */
+	if(fd<0)
+	{
+		cout<<"ERROR: could not open file "<<filename<<".\n";
+		exit(0);
+	}
+
+	struct stat info;
+	fstat(fd, &info);
+	map_size = info.st_size;
+
+	/* the mapping is writable, the in place operations copy the pages they change. */
+	void *data = MAP_FAILED;
+	if(map_size>=BINARY_HEADER_SIZE)
+		data = mmap(NULL, map_size, PROT_READ|PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(data==MAP_FAILED)
+	{
+		cout<<"ERROR: could not read file "<<filename<<".\n";
+		exit(0);
+	}
+
+	memcpy(&header, data, sizeof(header));
+	if(header.payload_bytes%8!=0 || header.payload_bytes!=map_size-BINARY_HEADER_SIZE)
+	{
+		cout<<"ERROR: file "<<filename<<" is not a valid binary set.\n";
+		exit(0);
+	}
+
+	if(header.range_start!=range_start || header.range_end!=range_end)
+	{
+		cout<<"ERROR: range of file "<<filename<<" does not match the specified range.\n";
+		exit(0);
+	}
+
+	const uint64_t *payload = (const uint64_t*)((char*)data+BINARY_HEADER_SIZE);
+	if(verify_checksums && checksum_words(payload, header.payload_bytes/8)!=header.checksum)
+	{
+		cout<<"ERROR: checksum of file "<<filename<<" does not match.\n";
+		exit(0);
+	}
+
+	return (char*)data;
+}
+
+/*
+ * This function calls f(key, container) for each block stored in the data of a binary file.
+ * Each block is its key, its type, card and length as 32-bit numbers, padding,
+ * and then its values or words padded to 8 bytes.
+ */
+template<class F>
+void for_each_stored_container(const char *data, const binary_header &header, const string &filename, F f)
+{
+	const char *p = data, *end = data+header.payload_bytes;
+	for(uint64_t k=0; k<header.count; k++)
+	{
+		uint64_t key;
+		uint32_t fields[4];
+		if(end-p<24)
+			break;
+		memcpy(&key, p, 8);
+		memcpy(fields, p+8, 16);
+		p += 24;
+
+		container c;
+		c.type = fields[0];
+		c.card = fields[1];
+		size_t bytes = c.type==BITMAP_CONTAINER ? 8*(size_t)fields[2] : 2*(size_t)fields[2];
+		if(c.type>RUN_CONTAINER || (c.type==BITMAP_CONTAINER && fields[2]!=CONTAINER_WORDS) || (size_t)(end-p)<bytes)
+		{
+			cout<<"ERROR: file "<<filename<<" is not a valid binary set.\n";
+			exit(0);
+		}
+
+		if(c.type==BITMAP_CONTAINER)
+			c.bits.assign((const uint64_t*)p, (const uint64_t*)p+CONTAINER_WORDS);
+		else
+			c.values.assign((const uint16_t*)p, (const uint16_t*)p+fields[2]);
+		p += (bytes+7)/8*8;
+
+		f(key, c);
+	}
+}
+
+/*
+ * This function loads a set from a binary file.
+ * A bitmap file is used in place from its mapping. A file of blocks is expanded into the words.
+ */
+void load_binary(const string &filename, set *s)
+{
+	binary_header header;
+	size_t map_size;
+	char *data = map_binary(filename, header, map_size);
+
+	if(header.kind==BINARY_BITMAP)
+	{
+		if(header.count!=s->word_count() || header.payload_bytes!=8*header.count)
+		{
+			cout<<"ERROR: file "<<filename<<" is not a valid binary set.\n";
+			exit(0);
+		}
+		s->adopt_mapping((uint64_t*)(data+BINARY_HEADER_SIZE), data, map_size);
+		return;
+	}
+
+	uint64_t *words = s->data();
+	size_t n = s->word_count();
+	for_each_stored_container(data+BINARY_HEADER_SIZE, header, filename, [&](uint64_t key, const container &c)
+	{
+		uint64_t w[CONTAINER_WORDS];
+		c.to_bitmap(w);
+		for(size_t i=0; i<CONTAINER_WORDS && key*CONTAINER_WORDS+i<n; i++)
+			words[key*CONTAINER_WORDS+i] = w[i];
+	});
+	munmap(data, map_size);
+}
+
+/*
+ * This function loads a sparse set from a binary file.
+ * The blocks are copied, a bitmap file is cut into blocks.
+ */
+void load_binary(const string &filename, sparse_set *s)
+{
+	binary_header header;
+	size_t map_size;
+	char *data = map_binary(filename, header, map_size);
+
+	if(header.kind==BINARY_BITMAP)
+	{
+		const uint64_t *words = (const uint64_t*)(data+BINARY_HEADER_SIZE);
+		for(uint64_t start=0; start<header.count; start+=CONTAINER_WORDS)
+		{
+			uint64_t w[CONTAINER_WORDS];
+			size_t m = min((uint64_t)CONTAINER_WORDS, header.count-start);
+			memset(w, 0, sizeof(w));
+			memcpy(w, words+start, m*sizeof(uint64_t));
+
+			container c;
+			c.from_bitmap(w);
+			if(c.card>0)
+				s->append(start/CONTAINER_WORDS, c);
+		}
+	}
+	else
+	{
+		for_each_stored_container(data+BINARY_HEADER_SIZE, header, filename, [&](uint64_t key, const container &c)
+		{
+			s->append(key, c);
+		});
+	}
+	munmap(data, map_size);
+}
+
+/*
+ * This function writes the header and the data of a binary file.
+ * @param filename: name of the file to be written to.
+ * @param kind, count: the fields of the header.
+ * @param payload, bytes: the data, a multiple of 8 bytes.
+ */
+void save_binary_file(const string &filename, uint32_t kind, uint64_t count, const void *payload, size_t bytes)
+{
+	binary_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, binary_magic, 8);
+	header.kind = kind;
+	header.range_start = range_start;
+	header.range_end = range_end;
+	header.count = count;
+	header.payload_bytes = bytes;
+	header.checksum = checksum_words((const uint64_t*)payload, bytes/8);
+
+	/* Opening the given file. */
+	int fd = open_output(filename);
+
+	/* Error while opening file. */
+	if(fd<0)
+	{
+		cout<<"ERROR: could not open file "<<filename<<".\n";
+		exit(0);
+	}
+
+	if(!write_all(fd, (const char*)&header, sizeof(header)) || !write_all(fd, (const char*)payload, bytes))
+	{
+		cout<<"ERROR: could not write file "<<filename<<".\n";
+		exit(0);
+	}
+	close(fd);
+}
+
+/* This function saves a set as a binary file of its words. */
+void save_binary(const string &filename, const set &s)
+{
+	save_binary_file(filename, BINARY_BITMAP, s.word_count(), s.data(), 8*s.word_count());
+}
+
+/* This function saves a sparse set as a binary file of its blocks. */
+void save_binary(const string &filename, const sparse_set &s)
+{
+	vector<uint64_t> payload;
+	for(size_t k=0; k<s.container_count(); k++)
+	{
+		const container &c = s.get_container(k);
+		uint32_t length = c.type==BITMAP_CONTAINER ? CONTAINER_WORDS : c.values.size();
+		uint32_t fields[4] = {(uint32_t)c.type, (uint32_t)c.card, length, 0};
+
+		payload.push_back(s.key(k));
+		payload.resize(payload.size()+2);
+		memcpy(&payload[payload.size()-2], fields, 16);
+
+		size_t start = payload.size();
+		if(c.type==BITMAP_CONTAINER)
+			payload.insert(payload.end(), c.bits.begin(), c.bits.end());
+		else
+		{
+			payload.resize(start+(2*c.values.size()+7)/8, 0);
+			memcpy(&payload[start], c.values.data(), 2*c.values.size());
+		}
+	}
+	save_binary_file(filename, BINARY_CONTAINERS, s.container_count(), payload.data(), 8*payload.size());
+}
+
+/*
+ * This function creates a set from the numbers in a file, or from a binary set file.
+ * @param filename: name of the file to be read.
+ * @param s: pointer to the set which is to be created.
+ * @return void: it just creates a set and doesn't return anything.
+ */
+template<class SET>
+void create_set(const string &filename, SET *s)
+{
+	/* binary files are loaded without parsing. */
+	if(is_binary_file(filename))
+	{
+		load_binary(filename, s);
+		return;
+	}
+
+	set_loader<SET> loader(filename, s);
+	parse_file(filename, loader);
+}
+
+/*
+ * This function creates a sparse set from the numbers in a file, or from a binary set file.
+ * The numbers are collected and sorted first, so the blocks are appended in increasing order
+ * instead of being inserted one by one. The errors are the ones of create_set() for a set.
+ * @param filename: name of the file to be read.
+ * @param s: pointer to the sparse set which is to be created.
+ */
+void create_set(const string &filename, sparse_set *s)
+{
+	if(is_binary_file(filename))
+	{
+		load_binary(filename, s);
+		return;
+	}
+
+	sparse_loader loader(filename);
+	parse_file(filename, loader);
+	loader.sort_numbers();
+	s->assign_sorted(loader.numbers);
+}
+
+
+/*
+ * This class adds the parsed numbers of one block to a set shared with other threads.
+ * Errors are only recorded, the file is parsed again by create_set() to report them.
+ */
+class atomic_loader
+{
+	set *s;
+	atomic<bool> &failed;
+
+	public:
+		atomic_loader(set *target, atomic<bool> &flag) : s(target), failed(flag) {}
+
+		void number(long long num)
+		{
+			if(num<range_start || num>range_end || !s->add_atomic(num))
+				failed = true;
+		}
+
+		void out_of_range()
+		{
+			failed = true;
+		}
+
+		void invalid()
+		{
+			failed = true;
+		}
+};
+
+/* An input file loaded by create_sets(). */
+struct input_file
+{
+	const string *name;
+	set *s;
+	input_source in;
+	const char *data;
+	size_t size;
+	atomic<bool> failed;
+
+	/* the first error of a file that is not mapped, it can not be parsed again. */
+	int error;
+	long long error_number;
+};
+
+/*
+ * This class adds the parsed numbers of a file that is not mapped to its set, on one thread.
+ * The first error is recorded, and reported by create_sets() in the order of the files.
+ */
+class stream_loader
+{
+	input_file *file;
+
+	void record(int error, long long num)
+	{
+		if(!file->failed)
+		{
+			file->error = error;
+			file->error_number = num;
+			file->failed = true;
+		}
+	}
+
+	public:
+		stream_loader(input_file *target) : file(target) {}
+
+		void number(long long num)
+		{
+			if(num<range_start || num>range_end)
+				record(LOAD_OUT_OF_RANGE, 0);
+			else if(!file->s->add(num))
+				record(LOAD_DUPLICATE, num);
+		}
+
+		void out_of_range()
+		{
+			record(LOAD_OUT_OF_RANGE, 0);
+		}
+
+		void invalid()
+		{
+			record(LOAD_INVALID, 0);
+		}
+};
+
+/* A block of an input file, the blocks start and end at white spaces. */
+struct parse_task
+{
+	input_file *file;
+	const char *begin;
+	const char *end;
+};
+
+/* smallest block of a file given to a thread. */
+#define MIN_CHUNK_SIZE (1<<20)
+
+/*
+ * This function creates sets from their files at once.
+ * Mapped files are cut into blocks at white spaces, and the blocks of all the files are parsed
+ * by usable_threads() threads. Pipes are parsed by a single thread each.
+ * If a file has an error, it is parsed again by create_set(), which reports the first error
+ * of the file in the same way as a single threaded run.
+ * @param names: the files, in the order their errors are reported.
+ * @param sets: the set of each file.
+ */
+void create_sets(const vector<string> &names, const vector<set*> &sets)
+{
+	size_t n = names.size();
+	int threads = usable_threads();
+
+	if(threads<=1)
+	{
+		for(size_t f=0; f<n; f++)
+			create_set(names[f], sets[f]);
+		return;
+	}
+
+	vector<input_file> files(n);
+	bool opened = true;
+
+	/* Opening the files, the errors are left to create_set() to report them in order. */
+	for(size_t f=0; f<n; f++)
+	{
+		files[f].name = &names[f];
+		files[f].s = sets[f];
+		files[f].data = NULL;
+		files[f].size = 0;
+		files[f].failed = false;
+		files[f].error = 0;
+
+		/* binary files are loaded here, the threads have nothing to parse in them. */
+		bool binary = is_binary_file(names[f]);
+		if(binary)
+			load_binary(names[f], sets[f]);
+		files[f].in.fd = -1;
+		if(opened)
+			opened = open_input(binary ? "/dev/null" : names[f], files[f].in);
+	}
+	if(!opened)
+	{
+		/* the files before the one that could not be opened are parsed first, as they are opened. */
+		for(size_t f=0; f<n; f++)
+		{
+			if(files[f].in.fd<0)
+			{
+				create_set(names[f], sets[f]);
+				continue;
+			}
+			set_loader<set> loader(names[f], sets[f]);
+			parse_input(names[f], files[f].in, loader);
+		}
+		return;
+	}
+
+	/* Mapping the regular files and cutting them into blocks. */
+	vector<parse_task> tasks;
+	for(size_t f=0; f<n; f++)
+	{
+		if(files[f].in.mappable)
+		{
+			struct stat info;
+			fstat(files[f].in.fd, &info);
+			files[f].size = info.st_size;
+			if(files[f].size==0)
+				continue;
+
+			void *data = mmap(NULL, files[f].size, PROT_READ, MAP_PRIVATE, files[f].in.fd, 0);
+			if(data!=MAP_FAILED)
+				files[f].data = (const char*)data;
+		}
+
+		/* a file that is not mapped is parsed as a whole. */
+		if(files[f].data==NULL)
+		{
+			parse_task task = {&files[f], NULL, NULL};
+			tasks.push_back(task);
+			continue;
+		}
+
+		size_t chunk = max((size_t)MIN_CHUNK_SIZE, files[f].size/(4*threads));
+		const char *p = files[f].data, *end = files[f].data+files[f].size;
+		while(p<end)
+		{
+			/* moving the end of the block past the next white space. */
+			const char *q = (size_t)(end-p)>chunk ? p+chunk : end;
+			while(q<end && !is_space(q[-1]))
+				q++;
+
+			parse_task task = {&files[f], p, q};
+			tasks.push_back(task);
+			p = q;
+		}
+	}
+
+	/* the threads take the blocks one by one, until none is left. */
+	atomic<size_t> next_task(0);
+	vector<thread> pool;
+	for(int t=0; t<threads && t<(int)tasks.size(); t++)
+	{
+		pool.push_back(thread([&]()
+		{
+			size_t i;
+			while((i = next_task++)<tasks.size())
+			{
+				input_file *file = tasks[i].file;
+				if(tasks[i].begin==NULL)
+				{
+					stream_loader loader(file);
+					parse_stream(file->in.fd, loader, file->in.prefix);
+				}
+				else
+				{
+					atomic_loader loader(file->s, file->failed);
+					parse_numbers(tasks[i].begin, tasks[i].end, loader);
+				}
+			}
+		}));
+	}
+	for(size_t t=0; t<pool.size(); t++)
+		pool[t].join();
+
+	for(size_t f=0; f<n; f++)
+	{
+		if(files[f].data!=NULL)
+			munmap((void*)files[f].data, files[f].size);
+		close_input(names[f], files[f].in);
+	}
+
+	/* Reporting the errors, parsing the mapped files again in order. */
+	for(size_t f=0; f<n; f++)
+	{
+		if(files[f].error)
+			load_error(names[f], files[f].error, files[f].error_number);
+		if(files[f].failed)
+		{
+			set s;
+			create_set(*files[f].name, &s);
+		}
+	}
+}
+
+/* the two digit strings of 00 to 99, used to format two digits at a time. */
+static const char digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/*
+ * This function formats a number in decimal.
+ * @param out: where the digits are written, it needs 20 bytes.
+ * @param v: the number to be formatted, taken as a signed 64-bit number.
+ * @return char*: the end of the digits written.
+ */
+static inline char* format_number(char *out, uint64_t v)
+{
+	if((int64_t)v<0)
+	{
+		*out++ = '-';
+		v = 0-v;
+	}
+
+	/* the digits are made from the end, two at a time. */
+	char digits[20];
+	char *p = digits+20;
+	while(v>=100)
+	{
+		p -= 2;
+		memcpy(p, digit_pairs+2*(v%100), 2);
+		v /= 100;
+	}
+	if(v>=10)
+	{
+		p -= 2;
+		memcpy(p, digit_pairs+2*v, 2);
+	}
+	else
+		*--p = '0'+v;
+
+	size_t n = digits+20-p;
+	memcpy(out, p, n);
+	return out+n;
+}
+
+/* size of the buffer in which write_set() formats the numbers. */
+#define WRITE_BUFFER_SIZE (1<<20)
+
+/*
+ * This class formats numbers into a large buffer, and writes the buffer to a file when full.
+ * The numbers are written one per line.
+ */
+class number_writer
+{
+	const string &filename;
+	int fd;
+	vector<char> buffer;
+	char *out;
+	char *limit;
+
+	public:
+		/* Opening the given file. */
+		number_writer(const string &name) : filename(name), buffer(WRITE_BUFFER_SIZE)
+		{
+			fd = open_output(filename);
+
+			/* Error while opening file. */
+			if(fd<0)
+			{
+				cout<<"ERROR: could not open file "<<filename<<".\n";
+				exit(0);
+			}
+
+			out = buffer.data();
+			limit = buffer.data()+buffer.size()-64*21;
+		}
+
+		/* the caller must call flush() after at most 64 numbers. */
+		void put(uint64_t v)
+		{
+			out = format_number(out, v);
+			*out++ = '\n';
+		}
+
+		/* This function writes the buffer when it may not have room for 64 more numbers. */
+		void flush(bool force = false)
+		{
+			if(out<=limit && !force)
+				return;
+
+			if(!write_all(fd, buffer.data(), out-buffer.data()))
+			{
+				cout<<"ERROR: could not write file "<<filename<<".\n";
+				exit(0);
+			}
+			out = buffer.data();
+		}
+
+		/* This function writes text that is already formatted, after the numbers before it. */
+		void write(const char *text, size_t n)
+		{
+			flush(true);
+			if(!write_all(fd, text, n))
+			{
+				cout<<"ERROR: could not write file "<<filename<<".\n";
+				exit(0);
+			}
+		}
+
+		/* closing the file. */
+		~number_writer()
+		{
+			flush(true);
+			close(fd);
+		}
+};
+
+/*
+ * This function writes the numbers of the bits set in some words of a set.
+ * @param output: where the numbers are written.
+ * @param words, n: the words.
+ * @param base: the number of the first bit of the words.
+ */
+void write_words(number_writer &output, const uint64_t *words, size_t n, uint64_t base)
+{
+	for(size_t i=0; i<n; i++, base+=64)
+	{
+		uint64_t w = words[i];
+		if(w==0)
+			continue;
+
+		while(w)
+		{
+			output.put(base+__builtin_ctzll(w));
+			w &= w-1;
+		}
+		output.flush();
+	}
+}
+
+/*
+ * This function formats the numbers of the bits set in some words, one per line.
+ * @param text: the buffer, grown to hold the numbers.
+ * @param words, n: the words.
+ * @param base: the number of the first bit of the words.
+ * @return size_t: the number of characters formatted.
+ */
+size_t format_words(vector<char> &text, const uint64_t *words, size_t n, uint64_t base)
+{
+	size_t members = count_or(words, words, n);
+	if(text.size()<members*21)
+		text.resize(members*21);
+
+	char *out = text.data();
+	for(size_t i=0; i<n; i++, base+=64)
+	{
+		uint64_t w = words[i];
+		while(w)
+		{
+			out = format_number(out, base+__builtin_ctzll(w));
+			*out++ = '\n';
+			w &= w-1;
+		}
+	}
+	return out-text.data();
+}
+
+/* Number of words of a set formatted at once by a thread while writing it. */
+#define WRITE_SHARD_WORDS (1<<12)
+
+/*
+ * This function writes the contents of a set to a file.
+ * Only the words that are not zero are visited, and their members are found by counting
+ * the trailing zeros. The numbers are formatted into a large buffer that is written at once.
+ * Large sets are formatted by many threads, a few shards for each thread at a time,
+ * and the shards are written in order.
+ * @param filename: name of the file to be written to.
+ * @param s: set that has to be written to file.
+ * @return void: doesnt return anything.
+ */
+void write_set(const string &filename, const set &s)
+{
+	number_writer output(filename);
+	size_t n = s.word_count();
+	int threads = usable_threads();
+	if(threads<=1 || n<2*WRITE_SHARD_WORDS)
+	{
+		write_words(output, s.data(), n, range_start);
+		return;
+	}
+
+	size_t round = 2*(size_t)threads*WRITE_SHARD_WORDS;
+	vector< vector<char> > text(2*threads);
+	vector<size_t> length(2*threads);
+
+	for(size_t start=0; start<n; start+=round)
+	{
+		size_t count = min(round, n-start);
+		for_each_shard(count, WRITE_SHARD_WORDS, [&](size_t first, size_t words)
+		{
+			size_t k = first/WRITE_SHARD_WORDS;
+			length[k] = format_words(text[k], s.data()+start+first, words, range_start+64*(start+first));
+		});
+
+		for(size_t k=0; k*WRITE_SHARD_WORDS<count; k++)
+			output.write(text[k].data(), length[k]);
+	}
+}
+
+/* This function writes the contents of a sparse set to a file, container by container. */
+void write_set(const string &filename, const sparse_set &s)
+{
+	number_writer output(filename);
+	int pending = 0;
+
+	s.for_each([&](uint64_t offset)
+	{
+		output.put((uint64_t)range_start+offset);
+		if(++pending==64)
+		{
+			output.flush();
+			pending = 0;
+		}
+	});
+}
+
+/*
+ * This function opens the file for the answer of a query.
+ * @param filename: name of the file to be written to.
+ * @return FILE*: the opened file.
+ */
+FILE* open_answer(const string &filename)
+{
+	int fd = open_output(filename);
+	FILE *output = fd<0 ? NULL : fdopen(fd, "w");
+
+	/* Error while opening file. */
+	if(output==NULL)
+	{
+		cout<<"ERROR: could not open file "<<filename<<".\n";
+		exit(0);
+	}
+	return output;
+}
+
+/* Results of sorted_reader::next(). */
+#define READ_NUMBER 0
+#define READ_END 1
+#define READ_OUT_OF_RANGE 2
+#define READ_INVALID 3
+#define READ_DUPLICATE 4
+#define READ_UNSORTED 5
+
+/*
+ * This class reads the numbers of a sorted file one at a time, with a buffer of constant size.
+ * It checks that each number is in the range and larger than the one before it.
+ */
+class sorted_reader
+{
+	input_source in;
+	int fd;
+	vector<char> buffer;
+	char *p;
+	char *end;
+	bool eof;
+	bool started;
+
+	public:
+		const string &filename;
+		long long value;
+
+		sorted_reader(const string &name, size_t buffer_size = READ_BUFFER_SIZE) : buffer(buffer_size), filename(name)
+		{
+			/* Error while opening file. */
+			if(!open_input(filename, in))
+			{
+				cout<<"ERROR: could not open file "<<filename<<".\n";
+				exit(0);
+			}
+			fd = in.fd;
+
+			/* the bytes read to find the format of a pipe are the first ones. */
+			memcpy(buffer.data(), in.prefix.data(), in.prefix.size());
+			p = buffer.data();
+			end = p+in.prefix.size();
+			eof = false;
+			started = false;
+		}
+
+		~sorted_reader()
+		{
+			close_input(filename, in);
+		}
+
+		/* This function makes sure the buffer holds k bytes, unless the file ends first. */
+		void fill(size_t k)
+		{
+			if((size_t)(end-p)>=k || eof)
+				return;
+
+			size_t left = end-p;
+			memmove(buffer.data(), p, left);
+			p = buffer.data();
+			end = p+left;
+
+			while((size_t)(end-p)<k && !eof)
+			{
+				ssize_t got = read(fd, end, buffer.data()+buffer.size()-end);
+				if(got<0)
+				{
+					cout<<"ERROR: could not read the input.\n";
+					exit(0);
+				}
+				eof = got==0;
+				end += got;
+			}
+		}
+
+		/*
+		 * This function reads the next number into value.
+		 * @return int: READ_NUMBER, READ_END at the end of the file, or the error found.
+		 */
+		int next()
+		{
+			/* skipping the white spaces between numbers. */
+			while(true)
+			{
+				fill(1);
+				if(p==end)
+					return READ_END;
+				if(!is_space(*p))
+					break;
+				p++;
+			}
+
+			/* a number has at most a sign and 19 digits, the longer ones are out of range. */
+			fill(24);
+
+			bool negative = false;
+			if(*p=='-' || *p=='+')
+			{
+				negative = *p=='-';
+				p++;
+			}
+
+			uint64_t u = 0;
+			int k = 0;
+			while(p<end && is_digit(*p))
+			{
+				if(k<19)
+					u = u*10 + *p-'0';
+				k++;
+				p++;
+			}
+
+			/* a number must be followed by a white space or the end of the file. */
+			if(k==0 || (p<end && !is_space(*p)))
+				return READ_INVALID;
+
+			if(k>19 || u>(uint64_t)LLONG_MAX+negative)
+				return READ_OUT_OF_RANGE;
+			long long v = negative ? (long long)(0-u) : (long long)u;
+			if(v<range_start || v>range_end)
+				return READ_OUT_OF_RANGE;
+
+			/* each number must be larger than the previous one. */
+			if(started && v<=value)
+			{
+				bool duplicate = v==value;
+				value = v;
+				return duplicate ? READ_DUPLICATE : READ_UNSORTED;
+			}
+
+			started = true;
+			value = v;
+			return READ_NUMBER;
+		}
+};
+
+/*
+ * This function reports an error found while merging, removes the partial output and exits.
+ * @param status: the error returned by sorted_reader::next().
+ * @param reader: the file that has the error.
+ */
+void merge_error(int status, const sorted_reader &reader)
+{
+	if(status==READ_OUT_OF_RANGE)
+		cout<<"ERROR: number not in the specified range.\n";
+	else if(status==READ_INVALID)
+		cout<<"ERROR: Invalid number found in file "<<reader.filename<<".\n";
+	else if(status==READ_DUPLICATE)
+	{
+		cout<<"ERROR: Duplicate number found in file "<<reader.filename<<"."<<endl;
+		cout<<"The number duplicated is: "<<reader.value<<endl;
+	}
+	else
+		cout<<"ERROR: file "<<reader.filename<<" is not sorted.\n";
+
+	if(output_file!="-")
+		unlink(output_file.c_str());
+	exit(0);
+}
+
+/*
+ * This function performs the operation on two sorted files by merging them (--sorted).
+ * It takes O(n+m) time and constant memory, so the files may be larger than the memory
+ * and the range may be wider than any set.
+ */
+void merge_sorted()
+{
+	sorted_reader a(input_file1), b(input_file2);
+	int status_a = a.next(), status_b = b.next();
+
+	/* sizes of the parts of the sets, and the bounds of the first set, for the queries. */
+	uint64_t a_only = 0, b_only = 0, both = 0;
+	long long a_min = a.value, a_max = a.value;
+
+	{
+		number_writer output(output_file);
+		int pending = 0;
+		bool query = operation>4;
+
+		/* which of the numbers only in a, only in b and in both are kept. */
+		bool keep_a = operation!=2;
+		bool keep_b = operation==1 || operation==4;
+		bool keep_both = operation==1 || operation==2;
+
+		while(status_a==READ_NUMBER || status_b==READ_NUMBER)
+		{
+			if(status_a!=READ_NUMBER && status_a!=READ_END)
+				merge_error(status_a, a);
+			if(status_b!=READ_NUMBER && status_b!=READ_END)
+				merge_error(status_b, b);
+
+			if(status_a==READ_NUMBER)
+				a_max = a.value;
+
+			if(status_b==READ_END || (status_a==READ_NUMBER && a.value<b.value))
+			{
+				a_only++;
+				if(keep_a && !query)
+					output.put(a.value);
+				status_a = a.next();
+			}
+			else if(status_a==READ_END || b.value<a.value)
+			{
+				b_only++;
+				if(keep_b && !query)
+					output.put(b.value);
+				status_b = b.next();
+			}
+			else
+			{
+				both++;
+				if(keep_both && !query)
+					output.put(a.value);
+				status_a = a.next();
+				status_b = b.next();
+			}
+
+			if(++pending==64)
+			{
+				output.flush();
+				pending = 0;
+			}
+		}
+	}
+
+	if(status_a!=READ_END)
+		merge_error(status_a, a);
+	if(status_b!=READ_END)
+		merge_error(status_b, b);
+
+	if(operation<=4)
+		return;
+
+	/* answering the query from the sizes of the parts. */
+	FILE *output = open_answer(output_file);
+	uint64_t any = a_only+b_only+both;
+
+	if(operation==5)
+		fprintf(output, "%llu\n", (unsigned long long)any);
+	else if(operation==6)
+		fprintf(output, "%llu\n", (unsigned long long)both);
+	else if(operation==7)
+		fprintf(output, "%llu\n", (unsigned long long)a_only);
+	else if(operation==8)
+		fprintf(output, "%llu\n", (unsigned long long)(a_only+b_only));
+	else if(operation==9)
+		fprintf(output, "%.6f\n", any ? (double)both/any : 1.0);
+	else if(operation==10)
+		fprintf(output, "%d\n", a_only==0 ? 1 : 0);
+	else if(operation==11)
+		fprintf(output, "%llu\n", (unsigned long long)(a_only+both));
+	else if(a_only+both>0)
+		fprintf(output, "%lld\n", operation==12 ? a_min : a_max);
+
+	fclose(output);
+}
+
+/* Instructions of a compiled set expression, they are run in postfix order on a stack. */
+#define EXPR_INPUT 0
+#define EXPR_NOT 1
+#define EXPR_OR 2
+#define EXPR_AND 3
+#define EXPR_DIFFERENCE 4
+#define EXPR_XOR 5
+
+struct expr_instruction
+{
+	int code;
+	int input;
+};
+
+/*
+ * This class compiles a set expression to postfix instructions.
+ * The operators, from the lowest to the highest precedence, are
+ * 	x | y: union,
+ * 	x ^ y: symmetric difference,
+ * 	x & y: intersection, and x - y: difference,
+ * 	~x: complement in the range.
+ * The inputs are named a, b, c, ..., z, aa, ab, ... in the order of the input files.
+ */
+class expression_parser
+{
+	const char *p;
+	vector<expr_instruction> &program;
+
+	void error()
+	{
+		cout<<"ERROR: Invalid expression!\n";
+		exit(0);
+	}
+
+	void skip_spaces()
+	{
+		while(is_space(*p))
+			p++;
+	}
+
+	void emit(int code, int input = -1)
+	{
+		expr_instruction ins = {code, input};
+		program.push_back(ins);
+	}
+
+	void parse_primary()
+	{
+		skip_spaces();
+		if(*p=='(')
+		{
+			p++;
+			parse_or();
+			skip_spaces();
+			if(*p!=')')
+				error();
+			p++;
+			return;
+		}
+
+		/* the name of an input, numbered like the columns of a spreadsheet. */
+		if(!(*p>='a' && *p<='z'))
+			error();
+		int input = 0;
+		while(*p>='a' && *p<='z')
+		{
+			input = input*26 + (*p-'a'+1);
+			p++;
+		}
+		emit(EXPR_INPUT, input-1);
+	}
+
+	void parse_unary()
+	{
+		skip_spaces();
+		if(*p=='~')
+		{
+			p++;
+			parse_unary();
+			emit(EXPR_NOT);
+			return;
+		}
+		parse_primary();
+	}
+
+	void parse_and()
+	{
+		parse_unary();
+		while(true)
+		{
+			skip_spaces();
+			if(*p!='&' && *p!='-')
+				return;
+			int code = *p=='&' ? EXPR_AND : EXPR_DIFFERENCE;
+			p++;
+			parse_unary();
+			emit(code);
+		}
+	}
+
+	void parse_xor()
+	{
+		parse_and();
+		while(true)
+		{
+			skip_spaces();
+			if(*p!='^')
+				return;
+			p++;
+			parse_and();
+			emit(EXPR_XOR);
+		}
+	}
+
+	void parse_or()
+	{
+		parse_xor();
+		while(true)
+		{
+			skip_spaces();
+			if(*p!='|')
+				return;
+			p++;
+			parse_xor();
+			emit(EXPR_OR);
+		}
+	}
+
+	public:
+		expression_parser(const char *text, vector<expr_instruction> &out) : p(text), program(out) {}
+
+		/* This function compiles the whole expression. */
+		void parse()
+		{
+			parse_or();
+			skip_spaces();
+			if(*p!='\0')
+				error();
+		}
+};
+
+/* number of words of each set combined at a time by evaluate_expression(). */
+#define EXPR_BLOCK_WORDS 512
+
+/*
+ * This function evaluates a compiled expression and writes the result to a file.
+ * The sets are combined a block of words at a time, the blocks stay in the cache while all the
+ * instructions run on them, and no set is made for the partial results.
+ * @param program: the compiled expression.
+ * @param sets: the input sets.
+ * @param filename: the output file.
+ */
+void evaluate_expression(const vector<expr_instruction> &program, const vector<set> &sets, const string &filename)
+{
+	number_writer output(filename);
+	size_t n = sets[0].word_count();
+
+	/* each level of the stack has its own block for the results. */
+	vector< vector<uint64_t> > scratch(program.size(), vector<uint64_t>(EXPR_BLOCK_WORDS));
+	vector<const uint64_t*> stack(program.size());
+	vector<uint64_t> ones(EXPR_BLOCK_WORDS, ~(uint64_t)0);
+
+	/* the bits after the end of the range must stay zero when complemented. */
+	int tail = (range_last()+1)%64;
+	uint64_t tail_mask = tail ? ((uint64_t)1<<tail)-1 : ~(uint64_t)0;
+
+	for(size_t start=0; start<n; start+=EXPR_BLOCK_WORDS)
+	{
+		size_t m = min((size_t)EXPR_BLOCK_WORDS, n-start);
+		int top = 0;
+
+		for(size_t k=0; k<program.size(); k++)
+		{
+			const expr_instruction &ins = program[k];
+			if(ins.code==EXPR_INPUT)
+			{
+				stack[top++] = sets[ins.input].data()+start;
+				continue;
+			}
+
+			if(ins.code==EXPR_NOT)
+			{
+				uint64_t *d = scratch[top-1].data();
+				kernel_xor(d, stack[top-1], ones.data(), m);
+				if(start+m==n)
+					d[m-1] &= tail_mask;
+				stack[top-1] = d;
+				continue;
+			}
+
+			uint64_t *d = scratch[top-2].data();
+			if(ins.code==EXPR_OR)
+				kernel_or(d, stack[top-2], stack[top-1], m);
+			else if(ins.code==EXPR_AND)
+				kernel_and(d, stack[top-2], stack[top-1], m);
+			else if(ins.code==EXPR_DIFFERENCE)
+				kernel_andnot(d, stack[top-2], stack[top-1], m);
+			else
+				kernel_xor(d, stack[top-2], stack[top-1], m);
+			stack[top-2] = d;
+			top--;
+		}
+
+		write_words(output, stack[0], m, (uint64_t)range_start+64*start);
+	}
+}
+
+/*
+ * This function runs the --expr mode: it compiles the expression, loads all the input files
+ * at once and writes the result.
+ */
+void run_expression()
+{
+	vector<expr_instruction> program;
+	expression_parser(expression.c_str(), program).parse();
+
+	for(size_t k=0; k<program.size(); k++)
+	{
+		if(program[k].code==EXPR_INPUT && program[k].input>=(int)input_files.size())
+		{
+			cout<<"ERROR: Expression uses more input files than given!\n";
+			exit(0);
+		}
+	}
+
+	/* expressions are evaluated on bitmaps, the complement needs the whole range anyway. */
+	vector<set> sets(input_files.size());
+	vector<set*> pointers;
+	for(size_t f=0; f<sets.size(); f++)
+		pointers.push_back(&sets[f]);
+	create_sets(input_files, pointers);
+
+	evaluate_expression(program, sets, output_file);
+}
+
+/*
+ * This function checks if the command line arguments are passed or not.
+ * If not, this asks for the arguments.
+ */
+void check_arguments(int args)
+{	
+	/* if the range is not passed. */
+    if(args<2)
+    {
+        cout<<"Enter the range (\"start-end\"): ";
+        string range;
+        cin>>range;
+
+        parse_range((char*)range.c_str());
+        args++;
+    }
+
+    /* if the operation to be performed is not passed. */
+    if(args<3)
+    {
+        cout<<"Enter the opration: ";
+        string op;
+        cin>>op;
+        parse_operation((char*)op.c_str());
+        args++;
+    }
+
+    /* if the first input file is not passed. */
+    if(args<4)
+    {
+        cout<<"Enter the first input file: ";
+        cin>>input_file1;
+        args++;
+    }
+
+    /* convert has a single input file. */
+    if(operation==14)
+        args++;
+
+    /* if the second input file is not passed. */
+    if(args<5)
+    {
+        cout<<"Enter the second input file: ";
+        cin>>input_file2;
+        args++;
+    }
+
+    /* if the output file is not passed. */
+    if(args<6)
+    {
+        cout<<"Enter the output file: ";
+        cin>>output_file;
+    }
+}
+
+/*
+ * This function answers a query operation and writes the answer to a file.
+ * The answers are counted on the words of the sets, no result set is made.
+ * Min and max of an empty set write an empty file.
+ * @param filename: name of the file to be written to.
+ * @param a, b: the two sets.
+ * @param op: the query, see parse_operation().
+ */
+template<class SET>
+void write_query(const string &filename, const SET &a, const SET &b, int op)
+{
+	FILE *output = open_answer(filename);
+	long long n;
+
+	if(op==5)
+		fprintf(output, "%llu\n", (unsigned long long)a.union_cardinality(b));
+	else if(op==6)
+		fprintf(output, "%llu\n", (unsigned long long)a.intersection_cardinality(b));
+	else if(op==7)
+		fprintf(output, "%llu\n", (unsigned long long)a.difference_cardinality(b));
+	else if(op==8)
+		fprintf(output, "%llu\n", (unsigned long long)a.sym_difference_cardinality(b));
+	else if(op==9)
+		fprintf(output, "%.6f\n", a.jaccard(b));
+	else if(op==10)
+		fprintf(output, "%d\n", a.is_subset(b) ? 1 : 0);
+	else if(op==11)
+		fprintf(output, "%llu\n", (unsigned long long)a.cardinality());
+	else if(op==12)
+	{
+		if(a.min(n))
+			fprintf(output, "%lld\n", n);
+	}
+	else if(a.max(n))
+		fprintf(output, "%lld\n", n);
+
+	fclose(output);
+}
+
+/* 
+ * This function performs the desired operation.
+ * The operation is done in place, so a is replaced by the result and no other set is allocated.
+ * @param op: the operation, 1 to 4.
+ */
+template<class SET>
+void set_operation(SET &a, const SET &b, int op)
+{
+    /* checking the operation to be performed. */
+    if(op==1)
+        a.union_with(b);
+    else if(op==2)
+        a.intersect_with(b);
+    else if(op==3)
+        a.subtract(b);
+    else
+        a.symmetric_subtract_with(b);
+}
+
+/*
+ * This function decides whether the sets are stored as sparse sets.
+ * A sparse set is used when a bitmap of the range would be much larger than the input files,
+ * that is when most of the range can not have members.
+ * @return bool: true for sparse sets, false for bitmaps.
+ */
+bool use_sparse_sets()
+{
+	if(backend!=AUTO_BACKEND)
+		return backend==SPARSE_BACKEND;
+
+	/* small bitmaps are always used. */
+	size_t bitmap_bytes = range_last()/8+1;
+	if(bitmap_bytes<((size_t)1<<26))
+		return false;
+
+	/* the size of pipes is not known, bitmaps are used as before. */
+	size_t input_bytes = 0;
+	string names[2] = {input_file1, input_file2};
+	for(int f=0; f<2; f++)
+	{
+		struct stat info;
+		if(f==1 && operation==14)
+			break;
+		if(stat(names[f].c_str(), &info)!=0 || !S_ISREG(info.st_mode))
+			return false;
+		input_bytes += info.st_size;
+	}
+
+	return bitmap_bytes>4*input_bytes;
+}
+
+/* This function writes a set to the output file, as text or as a binary file with --binary. */
+template<class SET>
+void write_output(const string &filename, const SET &s)
+{
+	if(binary_output)
+		save_binary(filename, s);
+	else
+		write_set(filename, s);
+}
+
+/*
+ * This function runs the convert operation, it writes the set of a text or binary file
+ * as text, or as a binary file with --binary.
+ */
+void run_convert()
+{
+	if(use_sparse_sets())
+	{
+		sparse_set a;
+		create_set(input_file1, &a);
+		a.optimize();
+		write_output(output_file, a);
+		return;
+	}
+
+	set a;
+	vector<string> names(1, input_file1);
+	vector<set*> sets(1, &a);
+	create_sets(names, sets);
+	write_output(output_file, a);
+}
+
+/*
+ * This function combines loaded sets in a balanced tree, the result is left in the first set.
+ * At each level the pairs of sets are combined at the same time by different threads,
+ * the last pair is combined by all the threads, shard by shard.
+ * @param sets: the sets, they are changed.
+ * @param kernel: the word kernel of the operation.
+ */
+void reduce_tree(const vector<set*> &sets, kernel_fn kernel)
+{
+	for(size_t step=1; step<sets.size(); step*=2)
+	{
+		vector<size_t> pairs;
+		for(size_t i=0; i+step<sets.size(); i+=2*step)
+			pairs.push_back(i);
+
+		if(pairs.size()==1)
+		{
+			run_kernel(kernel, sets[0]->data(), sets[0]->data(), sets[step]->data(), sets[0]->word_count());
+			continue;
+		}
+
+		atomic<size_t> next_pair(0);
+		vector<thread> pool;
+		for(int t=0; t<thread_count && t<(int)pairs.size(); t++)
+		{
+			pool.push_back(thread([&]()
+			{
+				size_t k;
+				while((k = next_pair++)<pairs.size())
+				{
+					set *a = sets[pairs[k]], *b = sets[pairs[k]+step];
+					kernel(a->data(), a->data(), b->data(), a->word_count());
+				}
+			}));
+		}
+		for(size_t t=0; t<pool.size(); t++)
+			pool[t].join();
+	}
+}
+
+/*
+ * This class counts, for each number, the sets it is present in, up to a threshold k.
+ * The counts are bit sliced: plane j holds bit j of the count of every number, so a set is
+ * added with a ripple carry over the planes, one word at a time. A number that reaches k is
+ * marked in reached and is not counted any more, so the counts never go past k.
+ */
+class threshold_counter
+{
+	long long k;
+	vector<set> planes;
+	set reached;
+
+	public:
+		threshold_counter(long long threshold) : k(threshold), planes(64-__builtin_clzll(threshold)) {}
+
+		/* This function adds a set to the counts, over the shards of the words. */
+		void add(const set &s)
+		{
+			int bits = planes.size();
+			vector<uint64_t*> plane(bits);
+			for(int j=0; j<bits; j++)
+				plane[j] = planes[j].data();
+			uint64_t *done = reached.data();
+			const uint64_t *x = s.data();
+
+			for_each_shard(s.word_count(), SHARD_WORDS, [&](size_t first, size_t count)
+			{
+				for(size_t i=first; i<first+count; i++)
+				{
+					uint64_t carry = x[i]&~done[i];
+					if(carry==0)
+						continue;
+
+					for(int j=0; j<bits && carry; j++)
+					{
+						uint64_t overflow = plane[j][i]&carry;
+						plane[j][i] ^= carry;
+						carry = overflow;
+					}
+
+					/* the numbers whose count is now k. */
+					uint64_t equal = ~(uint64_t)0;
+					for(int j=0; j<bits; j++)
+						equal &= (k>>j)&1 ? plane[j][i] : ~plane[j][i];
+					done[i] |= equal;
+				}
+			});
+		}
+
+		/* the numbers present in at least k of the sets. */
+		set& result()
+		{
+			return reached;
+		}
+};
+
+/*
+ * This function combines any number of bitmap files.
+ * The files are loaded in groups of at most thread_count files, that fit in cache_budget bytes
+ * besides the result; a group has one file if a bitmap is larger. The union and the intersection
+ * combine each group with the result so far in a balanced tree, the other thresholds add them
+ * to a threshold_counter.
+ * @param k: the numbers present in at least k files are kept.
+ */
+void kway_sets(long long k)
+{
+	size_t n = input_files.size();
+	size_t bitmap_bytes = range_last()/8+1;
+	size_t group = max((size_t)1, min((size_t)thread_count, cache_budget/bitmap_bytes));
+	kernel_fn kernel = k==1 ? kernel_or : kernel_and;
+	bool counting = k>1 && k<(long long)n;
+
+	set result;
+	unique_ptr<threshold_counter> counter;
+	if(counting)
+		counter.reset(new threshold_counter(k));
+
+	for(size_t start=0; start<n; start+=group)
+	{
+		vector<string> names(input_files.begin()+start, input_files.begin()+min(n, start+group));
+		vector<set> sets(names.size());
+		vector<set*> pointers;
+		for(size_t f=0; f<sets.size(); f++)
+			pointers.push_back(&sets[f]);
+		create_sets(names, pointers);
+
+		if(counting)
+		{
+			for(size_t f=0; f<sets.size(); f++)
+				counter->add(sets[f]);
+			continue;
+		}
+
+		/* the result so far is the first set of the tree. */
+		if(start>0)
+			pointers.insert(pointers.begin(), &result);
+		reduce_tree(pointers, kernel);
+		if(start==0)
+			result = std::move(sets[0]);
+	}
+
+	if(counting)
+		write_output(output_file, counter->result());
+	else if(k>(long long)n)
+		write_output(output_file, set());
+	else
+		write_output(output_file, result);
+}
+
+/*
+ * This class is a loser tree over the current numbers of sorted files, to merge any number
+ * of them. Each inner node holds the file that lost the match at that node, and node 0 holds
+ * the winner, the file with the smallest number. When the winner moves to its next number,
+ * only the matches on the path from its leaf are played again, log2(n) comparisons.
+ */
+class loser_tree
+{
+	vector<sorted_reader*> &readers;
+	vector<bool> ended;
+	vector<int> tree;
+	int n;
+
+	/* This function checks if file a has a smaller number than file b, ended files are larger. */
+	bool smaller(int a, int b) const
+	{
+		if(ended[a] || ended[b])
+			return !ended[a] && ended[b];
+		return readers[a]->value<readers[b]->value;
+	}
+
+	/* This function moves a file to its next number, the errors of the file are reported. */
+	void advance(int r)
+	{
+		int status = readers[r]->next();
+		if(status==READ_END)
+			ended[r] = true;
+		else if(status!=READ_NUMBER)
+			merge_error(status, *readers[r]);
+	}
+
+	public:
+		loser_tree(vector<sorted_reader*> &files) : readers(files), ended(files.size(), false), tree(files.size()), n(files.size())
+		{
+			for(int r=0; r<n; r++)
+				advance(r);
+
+			/* the matches of the first round, node i has the children 2i and 2i+1, file r is leaf n+r. */
+			vector<int> winner(2*n);
+			for(int r=0; r<n; r++)
+				winner[n+r] = r;
+			for(int node=n-1; node>=1; node--)
+			{
+				int a = winner[2*node], b = winner[2*node+1];
+				winner[node] = smaller(b, a) ? b : a;
+				tree[node] = smaller(b, a) ? a : b;
+			}
+			tree[0] = n>1 ? winner[1] : 0;
+		}
+
+		/* This function gives the file with the smallest number, -1 when all the files ended. */
+		int top() const
+		{
+			return ended[tree[0]] ? -1 : tree[0];
+		}
+
+		/* This function moves the winner to its next number, and finds the new winner. */
+		void pop()
+		{
+			int w = tree[0];
+			advance(w);
+			for(int node=(w+n)/2; node>=1; node/=2)
+			{
+				if(smaller(tree[node], w))
+					swap(tree[node], w);
+			}
+			tree[0] = w;
+		}
+};
+
+/*
+ * This function merges any number of sorted files, see merge_sorted().
+ * Each file is strictly increasing, so the number of times a number comes out of the loser
+ * tree in a row is the number of files it is in.
+ * @param k: the numbers present in at least k files are kept.
+ */
+void kway_sorted(long long k)
+{
+	/* each file is open at once, the limit of open files is raised as far as allowed. */
+	struct rlimit limit;
+	if(getrlimit(RLIMIT_NOFILE, &limit)==0 && limit.rlim_cur<limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	/* the buffers of the files share about the memory of 64 full buffers. */
+	size_t n = input_files.size();
+	size_t buffer_size = max((size_t)1<<16, ((size_t)READ_BUFFER_SIZE*64)/n);
+	vector<sorted_reader*> readers;
+	for(size_t f=0; f<n; f++)
+		readers.push_back(new sorted_reader(input_files[f], buffer_size));
+
+	{
+		number_writer output(output_file);
+		loser_tree merge(readers);
+		long long current = 0, count = 0;
+		int pending = 0;
+
+		for(int r; (r = merge.top())>=0; merge.pop())
+		{
+			long long v = readers[r]->value;
+			if(count>0 && v==current)
+			{
+				count++;
+				continue;
+			}
+
+			if(count>=k)
+			{
+				output.put(current);
+				if(++pending==64)
+				{
+					output.flush();
+					pending = 0;
+				}
+			}
+			current = v;
+			count = 1;
+		}
+		if(count>=k)
+			output.put(current);
+	}
+
+	for(size_t f=0; f<n; f++)
+		delete readers[f];
+}
+
+/*
+ * This function runs the k-way mode, --kway with union or intersection, or --at-least k.
+ * Sorted files are merged with --sorted, the other files are loaded as bitmaps.
+ */
+void run_kway()
+{
+	long long k = at_least>0 ? at_least : operation==1 ? 1 : (long long)input_files.size();
+	if(sorted_inputs)
+		kway_sorted(k);
+	else
+		kway_sets(k);
+}
+
+/* This class collects the parsed numbers of a delta file, and reports its errors. */
+class delta_loader
+{
+	const string &filename;
+	vector<long long> &numbers;
+
+	public:
+		delta_loader(const string &name, vector<long long> &target) : filename(name), numbers(target) {}
+
+		void number(long long num)
+		{
+			if(num<range_start || num>range_end)
+				out_of_range();
+			numbers.push_back(num);
+		}
+
+		void out_of_range()
+		{
+			cout<<"ERROR: number not in the specified range.\n";
+			exit(0);
+		}
+
+		void invalid()
+		{
+			cout<<"ERROR: Invalid number found in file "<<filename<<".\n";
+			exit(0);
+		}
+};
+
+/*
+ * This class changes the words of a binary bitmap file in place, through a shared mapping.
+ * Only the pages of the changed words are written, and the checksum in the header is
+ * patched with each changed word.
+ */
+class patched_bitmap
+{
+	const string &filename;
+	char *data;
+	size_t map_size;
+	binary_header *header;
+	uint64_t *words;
+
+	public:
+		patched_bitmap(const string &name) : filename(name)
+		{
+			binary_header h;
+			data = map_binary(filename, h, map_size, true);
+			if(h.kind!=BINARY_BITMAP || h.count!=range_last()/64+1 || h.payload_bytes!=8*h.count)
+			{
+				cout<<"ERROR: file "<<filename<<" is not a binary bitmap of the range.\n";
+				exit(0);
+			}
+			header = (binary_header*)data;
+			words = (uint64_t*)(data+BINARY_HEADER_SIZE);
+		}
+
+		/* unmapping the file, the changes are already in it. */
+		~patched_bitmap()
+		{
+			munmap(data, map_size);
+		}
+
+		uint64_t word(size_t i) const
+		{
+			return words[i];
+		}
+
+		void set_word(size_t i, uint64_t w)
+		{
+			header->checksum += checksum_word(w, i)-checksum_word(words[i], i);
+			words[i] = w;
+		}
+
+		/* the numbers of the delta of the file, sorted, from name.add and name.remove. */
+		vector<long long> adds, removes;
+
+		/*
+		 * This function reads the delta of the file. A missing file is an empty delta.
+		 * The delta is checked against the words before any of them is changed, a number is
+		 * added only if absent, and removed only if present or added.
+		 */
+		void read_delta()
+		{
+			for(int remove=0; remove<2; remove++)
+			{
+				string delta = filename+(remove ? ".remove" : ".add");
+				vector<long long> &numbers = remove ? removes : adds;
+				struct stat info;
+				if(stat(delta.c_str(), &info)!=0)
+					continue;
+
+				delta_loader loader(delta, numbers);
+				parse_file(delta, loader);
+				sort(numbers.begin(), numbers.end());
+
+				for(size_t k=0; k<numbers.size(); k++)
+				{
+					/* If duplicate number found. */
+					if(k>0 && numbers[k]==numbers[k-1])
+					{
+						cout<<"ERROR: Duplicate number found in file "<<delta<<"."<<endl;
+						cout<<"The number duplicated is: "<<numbers[k]<<endl;
+						exit(0);
+					}
+
+					bool valid = remove ? contains(numbers[k]) || binary_search(adds.begin(), adds.end(), numbers[k])
+						: !contains(numbers[k]);
+					if(!valid)
+					{
+						cout<<"ERROR: number "<<numbers[k]<<" of file "<<delta
+							<<(remove ? " is not" : " is already")<<" in the set.\n";
+						exit(0);
+					}
+				}
+			}
+		}
+
+		bool contains(long long n) const
+		{
+			uint64_t offset = (uint64_t)n-(uint64_t)range_start;
+			return (words[offset>>6]>>(offset&63))&1;
+		}
+
+		/*
+		 * This function applies the delta read by read_delta(), adds first and then removes.
+		 * @param touched: the positions of the changed words are appended to it.
+		 */
+		void apply_delta(vector<size_t> &touched)
+		{
+			for(int remove=0; remove<2; remove++)
+			{
+				const vector<long long> &numbers = remove ? removes : adds;
+				for(size_t k=0; k<numbers.size(); k++)
+				{
+					uint64_t offset = (uint64_t)numbers[k]-(uint64_t)range_start;
+					size_t i = offset>>6;
+					set_word(i, words[i]^((uint64_t)1<<(offset&63)));
+					touched.push_back(i);
+				}
+			}
+		}
+};
+
+/*
+ * This function runs the delta mode (--delta result).
+ * The inputs and the result are binary bitmap files of the range, saved with --binary, and the
+ * result is the operation of the inputs. The deltas of the inputs, input.add and input.remove,
+ * are applied to the input files, and only the words of the result that they touch are
+ * computed again. All three files are changed in place.
+ * The change of the result is written in the same form, to output.add and output.remove,
+ * so the output can name the result to chain the deltas of a later step.
+ * With --no-verify the files are not read in full, the time is in the size of the deltas.
+ */
+void run_delta()
+{
+	if(operation<1 || operation>4)
+	{
+		cout<<"ERROR: Invalid Operation!\n";
+		exit(0);
+	}
+
+	patched_bitmap a(input_file1), b(input_file2), result(delta_result);
+
+	/* all the deltas are checked before any file is changed. */
+	a.read_delta();
+	b.read_delta();
+
+	vector<size_t> touched;
+	a.apply_delta(touched);
+	b.apply_delta(touched);
+	sort(touched.begin(), touched.end());
+	touched.erase(unique(touched.begin(), touched.end()), touched.end());
+
+	kernel_fn kernels[4] = {kernel_or, kernel_and, kernel_andnot, kernel_xor};
+	kernel_fn kernel = kernels[operation-1];
+
+	string added_name = output_file+".add", removed_name = output_file+".remove";
+	number_writer added(added_name), removed(removed_name);
+	for(size_t k=0; k<touched.size(); k++)
+	{
+		size_t i = touched[k];
+		uint64_t x = a.word(i), y = b.word(i), w, old = result.word(i);
+		kernel(&w, &x, &y, 1);
+		if(w==old)
+			continue;
+
+		uint64_t gained = w&~old, lost = old&~w;
+		write_words(added, &gained, 1, (uint64_t)range_start+64*i);
+		write_words(removed, &lost, 1, (uint64_t)range_start+64*i);
+		result.set_word(i, w);
+	}
+}
+
+/*
+ * This class keeps the sets of the batch mode loaded, by the name of their file.
+ * The sets used least recently are dropped when their memory is over the budget; a set that
+ * is dropped while in use stays alive until its last user is done.
+ * A set is loaded by the first thread that asks for it, the others wait for it.
+ */
+class set_cache
+{
+	struct entry
+	{
+		shared_future< shared_ptr<const set> > loaded;
+		list<string>::iterator position;
+		size_t bytes;
+	};
+
+	mutex lock;
+	map<string, entry> entries;
+	list<string> recent;
+	size_t budget;
+	size_t used;
+
+	public:
+		set_cache(size_t memory) : budget(memory), used(0) {}
+
+		/*
+		 * This function gives the set of a file, loading it if it is not in the cache.
+		 * @param filename: the file of the set.
+		 * @return shared_ptr<const set>: the set.
+		 */
+		shared_ptr<const set> get(const string &filename)
+		{
+			unique_lock<mutex> guard(lock);
+			map<string, entry>::iterator it = entries.find(filename);
+			if(it!=entries.end())
+			{
+				/* moving the set to the front of the recently used ones. */
+				recent.splice(recent.begin(), recent, it->second.position);
+				shared_future< shared_ptr<const set> > loaded = it->second.loaded;
+				guard.unlock();
+				return loaded.get();
+			}
+
+			promise< shared_ptr<const set> > loading;
+			entry &e = entries[filename];
+			e.loaded = loading.get_future().share();
+			recent.push_front(filename);
+			e.position = recent.begin();
+			e.bytes = 0;
+			guard.unlock();
+
+			shared_ptr<set> s(new set());
+			create_set(filename, s.get());
+			loading.set_value(s);
+
+			guard.lock();
+			it = entries.find(filename);
+			if(it!=entries.end() && it->second.bytes==0)
+			{
+				it->second.bytes = 8*s->word_count();
+				used += it->second.bytes;
+			}
+
+			/* dropping the sets used least recently, the one just loaded is kept. */
+			while(used>budget && recent.size()>1)
+			{
+				map<string, entry>::iterator last = entries.find(recent.back());
+				used -= last->second.bytes;
+				recent.pop_back();
+				entries.erase(last);
+			}
+			return s;
+		}
+
+		/* This function drops the set of a file, after the file is written. */
+		void invalidate(const string &filename)
 		{
-			/*
-			 * first the difference of b with current set is taken.
-			 * then, the difference of current set with b is taken.
-			 * then, the union of second with first is taken.
-			 */
-			return set_difference(b).set_union(b.set_difference(*this));
+			lock_guard<mutex> guard(lock);
+			map<string, entry>::iterator it = entries.find(filename);
+			if(it!=entries.end())
+			{
+				used -= it->second.bytes;
+				recent.erase(it->second.position);
+				entries.erase(it);
+			}
 		}
 };
 
+/* A command of the batch mode, and the commands it has to wait for. */
+struct batch_command
+{
+	int op;
+	string input1;
+	string input2;
+	string output;
+	vector<size_t> after;
+};
+
 /*
- * This function parses the range provided in the console to get the range values.
- * @param range: the range argument in the console.
- * @return void: it just sets the range global variables.
+ * This function reads the script of the batch mode.
+ * Each line is "operation input1 input2 output", or "convert input output", as on the
+ * command line. Empty lines and lines starting with # are skipped.
+ * A command waits for the earlier commands that write its files, and a command that writes
+ * a file waits for the earlier commands that use it.
+ * @param filename: the script.
+ * @return vector<batch_command>: the commands in order.
  */
-void parse_range(char *range)
+vector<batch_command> read_batch(const string &filename)
 {
-	/* len stores the length of range string. */
-	int len = strlen(range);
+	FILE *script = fopen(filename.c_str(), "r");
 
-	int i=0;
-
-	/* if number is of the form -4 */
-	if(range[0] == '-')
+	/* Error while opening file. */
+	if(script==NULL)
 	{
-		cout<<"ERROR: Invalid range!\n";
+		cout<<"ERROR: could not open file "<<filename<<".\n";
 		exit(0);
 	}
 
-	/* parsing the start index. */
-	while(i<len && range[i]!='-')
+	vector<batch_command> commands;
+	map<string, size_t> last_writer;
+	map<string, vector<size_t> > readers;
+
+	char line[4096];
+	int line_number = 0;
+	while(fgets(line, sizeof(line), script)!=NULL)
 	{
-		/* if it contains invalid characters. */
-		if(!(range[i]>='0' && range[i]<='9'))
+		line_number++;
+
+		char words[4][1024];
+		int n = sscanf(line, "%1023s %1023s %1023s %1023s", words[0], words[1], words[2], words[3]);
+		if(n<=0 || words[0][0]=='#')
+			continue;
+
+		batch_command c;
+		c.op = operation_code(words[0]);
+		bool valid = c.op!=0 && n==(c.op==14 ? 3 : 4);
+		if(!valid)
 		{
-			cout<<"ERROR: Invalid range!\n";
+			cout<<"ERROR: Invalid command in line "<<line_number<<" of "<<filename<<".\n";
 			exit(0);
 		}
 
-		range_start = range_start*10 + range[i]-'0';
-		i++;
-	}
+		c.input1 = words[1];
+		c.input2 = c.op==14 ? "" : words[2];
+		c.output = words[n-1];
 
-	i++;
+		/* reading a file waits for the command that writes it. */
+		string inputs[2] = {c.input1, c.input2};
+		for(int f=0; f<2; f++)
+		{
+			if(inputs[f]!="" && last_writer.count(inputs[f]))
+				c.after.push_back(last_writer[inputs[f]]);
+		}
 
-	/* if number is of the form 0- */
-	if(i==len)
-	{
-		cout<<"ERROR: Invalid range!\n";
-		exit(0);
-	}
+		/* writing a file waits for the commands that write or read it before. */
+		if(last_writer.count(c.output))
+			c.after.push_back(last_writer[c.output]);
+		vector<size_t> &users = readers[c.output];
+		c.after.insert(c.after.end(), users.begin(), users.end());
+		users.clear();
 
-	/* parsing the end of the range. */
-	while(i<len)
-	{
-		/* if it contains invalid characters. */
-		if(!(range[i]>='0' && range[i]<='9'))
+		size_t index = commands.size();
+		for(int f=0; f<2; f++)
 		{
-			cout<<"ERROR: Invalid range!\n";
-			exit(0);
+			if(inputs[f]!="")
+				readers[inputs[f]].push_back(index);
 		}
-
-		range_end = range_end*10 + range[i]-'0';
-		i++;
+		last_writer[c.output] = index;
+		commands.push_back(c);
 	}
 
-	/*
-	 * Error in case of invalid ranges such as,
-	 * 		When end index is smaller than start index. (3000-1000)
-	 *		When no start or end range is provided. (-1000, 1000-)
-	 */
-	if(range_end<range_start)
-	{
-		cout<<"ERROR: Invalid range!\n";
-		exit(0);
-	}
+	fclose(script);
+	return commands;
 }
 
-
 /*
- * This function parses the argument for the desired operation to perform.
- * @param op: command line argument.
- * @return void: does not return anything.
+ * This function runs one command of the batch mode on the sets of the cache.
+ * The sets of the cache are not changed, the operations make a new set for their result.
  */
-void parse_operation(char *op)
+void run_batch_command(const batch_command &c, set_cache &cache)
 {
-	int len = strlen(op);
+	shared_ptr<const set> a = cache.get(c.input1);
 
-	/* changing the upper case characters to lower case to support case-insensitiveness. */
-	for(int i=0; i<len; i++)
+	if(c.op==14)
+		write_output(c.output, *a);
+	else
 	{
-		if((!(op[i]>='a' && op[i]<='z')) && op[i]!='_')
-			op[i] = op[i]^' ';
+		shared_ptr<const set> b = cache.get(c.input2);
+		if(c.op>4)
+			write_query(c.output, *a, *b, c.op);
+		else if(c.op==1)
+			write_output(c.output, a->set_union(*b));
+		else if(c.op==2)
+			write_output(c.output, a->set_intersection(*b));
+		else if(c.op==3)
+			write_output(c.output, a->set_difference(*b));
+		else
+			write_output(c.output, a->set_set_difference(*b));
 	}
 
-	/* checking for the desired operation. */
-	if(strcmp(op, "union")==0)
-		operation = 1;
-	else if(strcmp(op, "intersection")==0)
-		operation = 2;
-	else if(strcmp(op, "difference")==0)
-		operation = 3;
-	else if(strcmp(op, "sym_difference")==0)
-		operation = 4;
-	else
+	/* the file has changed, its set is loaded again when used. */
+	cache.invalidate(c.output);
+}
+
+/*
+ * This function runs the batch mode (--batch script).
+ * All the commands use the range of the command line, and their sets are kept in a cache
+ * of cache_budget bytes (--cache-mb), so a file used by many commands is loaded once.
+ * The commands are run by thread_count threads, in the order of the script; a command
+ * waits for the earlier commands it depends on. The operations of a command run on its thread.
+ */
+void run_batch()
+{
+	vector<batch_command> commands = read_batch(batch_file);
+	set_cache cache(cache_budget);
+
+	vector< promise<void> > done(commands.size());
+	vector< shared_future<void> > finished;
+	for(size_t k=0; k<commands.size(); k++)
+		finished.push_back(done[k].get_future().share());
+
+	/* the threads take the commands in order, so the commands waited for are already taken. */
+	atomic<size_t> next_command(0);
+	vector<thread> pool;
+	for(int t=0; t<thread_count && t<(int)commands.size(); t++)
 	{
-		/* No valid operation found. */
-		cout<<"ERROR: Invalid Operation!\n";
-		exit(0);
+		pool.push_back(thread([&]()
+		{
+			operation_threads = 1;
+
+			size_t k;
+			while((k = next_command++)<commands.size())
+			{
+				for(size_t d=0; d<commands[k].after.size(); d++)
+					finished[commands[k].after[d]].wait();
+
+				run_batch_command(commands[k], cache);
+				done[k].set_value();
+			}
+		}));
 	}
+	for(size_t t=0; t<pool.size(); t++)
+		pool[t].join();
 }
 
+/* This function returns the size of a file in bytes, 0 for pipes and missing files. */
+uint64_t file_bytes(const string &filename)
+{
+	struct stat info;
+	return stat(filename.c_str(), &info)==0 && S_ISREG(info.st_mode) ? info.st_size : 0;
+}
+
+/* The hardware counters read for each phase, when the kernel allows them. */
+#define COUNTERS 4
+static const char *counter_names[COUNTERS] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+static const uint64_t counter_events[COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
 
 /*
- * This function parses the arguments passed through the console.
- * @param args: number of arguments passed.
- * @param argc: argument list passed as pointer to array of characters.
- * @return void: it parses the arguments and sets the global variables, doesnt return anything.
+ * This class measures the phases of a run for --stats and --stats-json.
+ * Each phase has its wall time, the bytes read and written, the number of elements it handled,
+ * and the hardware counters of all the threads of the process. The counters of a thread are
+ * added when it ends, the threads of the tool end inside the phase that starts them.
+ * The report is made when the object is destroyed, at the end of a run without errors.
+ * The tool only makes one when asked to, so the phases cost nothing otherwise.
  */
-void parse_arguments(int args, char **argc)
+class run_stats
 {
-	/* Error if more than five arguments. */
-	if(args>6)
+	struct phase
 	{
-		cout<<"ERROR: Invalid arguments!\n";
-		exit(0);
-	}
+		string name;
+		double seconds;
+		uint64_t bytes_read;
+		uint64_t bytes_written;
+		uint64_t elements;
+		uint64_t counters[COUNTERS];
+	};
 
-	for(int i=1; i<args; i++)
+	vector<phase> phases;
+	int fds[COUNTERS];
+	bool counting;
+	chrono::steady_clock::time_point start;
+	uint64_t counter_start[COUNTERS];
+
+	/* This function reads the counters, they are zero if not available. */
+	void read_counters(uint64_t *values)
 	{
-		/* Parsing the range argument. */
-		if(i==1)
-			parse_range(argc[1]);
+		for(int c=0; c<COUNTERS; c++)
+		{
+			values[c] = 0;
+			if(fds[c]>=0 && read(fds[c], &values[c], sizeof(uint64_t))!=sizeof(uint64_t))
+				values[c] = 0;
+		}
+	}
 
-		/* Parsing the operation argument. */
-		if(i==2)
-			parse_operation(argc[2]);
+	public:
+		/* Opening the counters of the process and of the threads it starts, in user mode. */
+		run_stats()
+		{
+			counting = false;
+			for(int c=0; c<COUNTERS; c++)
+			{
+				struct perf_event_attr attr;
+				memset(&attr, 0, sizeof(attr));
+				attr.size = sizeof(attr);
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = counter_events[c];
+				attr.inherit = 1;
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+				fds[c] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+				counting |= fds[c]>=0;
+			}
+		}
 
-		/* First input file. */
-		if(i==3)
-			input_file1 = (string)argc[3];
+		/* This function starts a phase, the phases follow each other. */
+		void begin(const char *name)
+		{
+			phase p;
+			p.name = name;
+			phases.push_back(p);
+			read_counters(counter_start);
+			start = chrono::steady_clock::now();
+		}
+
+		/*
+		 * This function ends the current phase.
+		 * @param bytes_read, bytes_written: the bytes of the files read and written by the phase.
+		 * @param elements: the numbers, or the bits of the range, handled by the phase.
+		 */
+		void end(uint64_t bytes_read, uint64_t bytes_written, uint64_t elements)
+		{
+			phase &p = phases.back();
+			p.seconds = chrono::duration<double>(chrono::steady_clock::now()-start).count();
+			read_counters(p.counters);
+			for(int c=0; c<COUNTERS; c++)
+				p.counters[c] -= counter_start[c];
+			p.bytes_read = bytes_read;
+			p.bytes_written = bytes_written;
+			p.elements = elements;
+		}
 
-		/* Second input file. */
-		if(i==4)
-			input_file2 = (string)argc[4];
+		/* the report, with the peak resident memory of the whole run. */
+		~run_stats()
+		{
+			struct rusage usage;
+			getrusage(RUSAGE_SELF, &usage);
+			uint64_t peak_rss = (uint64_t)usage.ru_maxrss*1024;
 
-		/* Output file name. */
-		if(i==5)
-			output_file = (string)argc[5];
+			if(stats_file=="")
+			{
+				fprintf(stderr, "%-12s %12s %14s %14s %14s %14s", "phase", "seconds", "bytes read",
+					"bytes written", "elements", "elements/s");
+				for(int c=0; c<COUNTERS && counting; c++)
+					fprintf(stderr, " %14s", counter_names[c]);
+				fprintf(stderr, "\n");
+
+				for(size_t k=0; k<phases.size(); k++)
+				{
+					const phase &p = phases[k];
+					fprintf(stderr, "%-12s %12.6f %14llu %14llu %14llu %14.0f", p.name.c_str(), p.seconds,
+						(unsigned long long)p.bytes_read, (unsigned long long)p.bytes_written,
+						(unsigned long long)p.elements, p.seconds>0 ? p.elements/p.seconds : 0.0);
+					for(int c=0; c<COUNTERS && counting; c++)
+						fprintf(stderr, " %14llu", (unsigned long long)p.counters[c]);
+					fprintf(stderr, "\n");
+				}
+				fprintf(stderr, "peak RSS: %llu bytes, threads: %d%s\n", (unsigned long long)peak_rss,
+					thread_count, counting ? "" : ", hardware counters not available");
+			}
+			else
+			{
+				FILE *output = open_answer(stats_file);
+				fprintf(output, "{\n  \"threads\": %d,\n  \"peak_rss_bytes\": %llu,\n  \"counters\": %s,\n  \"phases\": [",
+					thread_count, (unsigned long long)peak_rss, counting ? "true" : "false");
+				for(size_t k=0; k<phases.size(); k++)
+				{
+					const phase &p = phases[k];
+					fprintf(output, "%s\n    {\"name\": \"%s\", \"seconds\": %.9f, \"bytes_read\": %llu, \"bytes_written\": %llu, "
+						"\"elements\": %llu, \"elements_per_second\": %.0f", k ? "," : "", p.name.c_str(), p.seconds,
+						(unsigned long long)p.bytes_read, (unsigned long long)p.bytes_written,
+						(unsigned long long)p.elements, p.seconds>0 ? p.elements/p.seconds : 0.0);
+					for(int c=0; c<COUNTERS && counting; c++)
+						fprintf(output, ", \"%s\": %llu", counter_names[c], (unsigned long long)p.counters[c]);
+					fprintf(output, "}");
+				}
+				fprintf(output, "\n  ]\n}\n");
+				fclose(output);
+			}
+
+			for(int c=0; c<COUNTERS; c++)
+				if(fds[c]>=0)
+					close(fds[c]);
+		}
+};
+
+/* The measures of the run, NULL without --stats. */
+run_stats *stats = NULL;
+
+/* This function returns the size of the input files of the run, 0 for pipes. */
+uint64_t input_bytes()
+{
+	uint64_t bytes = 0;
+	if(!input_files.empty())
+	{
+		for(size_t f=0; f<input_files.size(); f++)
+			bytes += file_bytes(input_files[f]);
+		return bytes;
 	}
+	bytes = file_bytes(input_file1);
+	if(operation!=14)
+		bytes += file_bytes(input_file2);
+	return bytes;
 }
 
+#ifdef SET_BENCHMARK
 /*
- * This function creates a set from the numbers in a file.
- * @param filename: name of the file to be read.
- * @param s: pointer to the set which is to be created.
- * @return void: it just creates a set and doesn't return anything.
+ * Micro benchmarks for the set, built instead of the tool with -DSET_BENCHMARK.
+ * 	g++ -O2 -DSET_BENCHMARK set_implementation.cpp -o set_benchmark
  */
-void create_set(string filename, set *s)
+
+/* This function returns the current time in nanoseconds. */
+double now_ns()
 {
-	int num;
+	return chrono::duration<double, nano>(chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-	/* Opening the given file. */
-	FILE *input = fopen(filename.c_str(), "r");
+/*
+ * This function times the construction of an empty set for range sizes from 10^3 to 10^9.
+ * The old construction, with one push_back() per number, is timed for comparison up to 10^8.
+ */
+void benchmark_construction()
+{
+	printf("%12s %16s %16s\n", "range", "set() ns", "push_back ns");
 
-	/* Error while opening file. */
-	if(input==NULL)
+	for(long long width=1000; width<=1000000000LL; width*=10)
 	{
-		cout<<"ERROR: could not open file "<<filename<<".\n";
-		exit(0);
+		range_start = 0;
+		range_end = width-1;
+
+		/* best of a few runs, the set is destroyed inside the timed region. */
+		double best = 1e30;
+		for(int run=0; run<5; run++)
+		{
+			double start = now_ns();
+			{
+				set s;
+			}
+			best = min(best, now_ns()-start);
+		}
+		printf("%12lld %16.0f", width, best);
+
+		if(width<=100000000LL)
+		{
+			double start = now_ns();
+			{
+				vector<bool> old;
+				for(long long i=0; i<width; i++)
+					old.push_back(false);
+			}
+			printf(" %16.0f\n", now_ns()-start);
+		}
+		else
+			printf(" %16s\n", "-");
 	}
+}
+
+/* Random numbers for the generated files, a splitmix64 generator with a fixed seed. */
+uint64_t random_state = 0x2545f4914f6cdd1dULL;
+
+double random_unit()
+{
+	uint64_t z = (random_state += 0x9e3779b97f4a7c15ULL);
+	z = (z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+	z = (z^(z>>27))*0x94d049bb133111ebULL;
+	z ^= z>>31;
+	return ((z>>11)+0.5)*(1.0/9007199254740992.0);
+}
+
+/* How the members of a generated file are spread over the range. */
+#define SKEW_UNIFORM 0
+#define SKEW_CLUSTERED 1
+#define SKEW_LINEAR 2
+const char *skew_names[] = {"uniform", "clustered", "linear"};
+
+/*
+ * This function generates a file of numbers in the range [0, width).
+ * 	uniform: each number is present with the given density.
+ * 	clustered: blocks of 2^16 numbers are either empty or present with a density 8 times larger.
+ * 	linear: the density falls from twice the given one at 0 to none at the end of the range.
+ * The members are found by jumping over geometric gaps, so the time is in the number of members.
+ * @return uint64_t: the number of members written.
+ */
+uint64_t generate_file(const string &filename, long long width, double density, int skew)
+{
+	range_start = 0;
+	range_end = width-1;
+	set s;
+	uint64_t members = 0;
 
-	/* Reading numbers from file. */
-	while(fscanf(input, "%d", &num)!=EOF)
+	double x = -1;
+	while(true)
 	{
-		/* If numbers out of range. */
-		if(num<range_start || num>range_end)
+		double p = density;
+		if(skew==SKEW_CLUSTERED)
 		{
-			cout<<"ERROR: number not in the specified range.\n";
-			exit(0);
+			/* whether the block of x+1 has members is decided by a hash of the block. */
+			uint64_t block = (uint64_t)(x+1)>>16, keep = random_state;
+			random_state = block*0x9e3779b97f4a7c15ULL;
+			bool active = random_unit()<0.125;
+			random_state = keep;
+			p = active ? min(1.0, 8*density) : 0;
+			if(p==0)
+			{
+				x = (double)((block+1)<<16)-1;
+				if(x>=width-1)
+					break;
+				continue;
+			}
 		}
+		else if(skew==SKEW_LINEAR)
+			p = max(1e-9, min(1.0, 2*density*(1-(x+1)/width)));
 
-		/* Adding the numbers to the set. */
-		if(!s->add(num))
+		/* the gap to the next member, geometric with parameter p. */
+		double gap = p>=1 ? 1 : floor(log(random_unit())/log(1-p))+1;
+		if(skew==SKEW_CLUSTERED && (uint64_t)(x+gap)>>16!=(uint64_t)(x+1)>>16)
 		{
-			/* If duplicate number found. */
-			cout<<"ERROR: Duplicate number found in file "<<filename<<"."<<endl;
-			cout<<"The number duplicated is: "<<num<<endl;
-			exit(0);
+			x = (double)((((uint64_t)(x+1)>>16)+1)<<16)-1;
+			if(x>=width-1)
+				break;
+			continue;
 		}
+		x += gap;
+		if(x>=width)
+			break;
+		s.add((long long)x);
+		members++;
 	}
 
-	/* Closing the file. */
-	fclose(input);
+	write_set(filename, s);
+	return members;
 }
 
+/*
+ * This function prints one result of the benchmark as a line of CSV.
+ * @param elements: the numbers or bits handled, for ns/element.
+ * @param bytes: the bytes read and written, for GB/s.
+ * @param ns: the best time of the runs.
+ */
+void report(long long width, double density, int skew, const char *phase, uint64_t elements, uint64_t bytes, double ns)
+{
+	printf("%lld,%g,%s,%s,%d,%llu,%llu,%.0f,%.4f,%.4f\n", width, density, skew_names[skew], phase, thread_count,
+		(unsigned long long)elements, (unsigned long long)bytes, ns, elements ? ns/elements : 0.0, bytes/ns);
+	fflush(stdout);
+}
 
 /*
- * This function writes the contents of a set to a file.
- * @param filename: name of the file to be written to.
- * @param s: set that has to be written to file.
- * @return void: doesnt return anything.
+ * This function times the tool over a grid of range widths, densities and skews.
+ * For each point two files are generated, and the best of a few runs is taken for
+ * ingestion of both files, each of the four operations and the output of the union.
+ * Ingestion and output are per number, the operations are per bit of the range.
+ * @param max_width: the largest range width, the widths go up by 10 from 10^6.
+ * @param dir: the directory of the generated files.
+ * @param runs: the number of runs of each phase.
  */
-void write_set(string filename, set s)
+void benchmark_grid(long long max_width, const string &dir, int runs)
 {
-	int num;
+	const double densities[] = {0.001, 0.01, 0.1, 0.5};
+	string names[2] = {dir+"/set_benchmark_a.txt", dir+"/set_benchmark_b.txt"};
+	string output = dir+"/set_benchmark_out.txt";
 
-	/* Opening the given file. */
-	FILE *output = fopen(filename.c_str(), "w");
+	printf("width,density,skew,phase,threads,elements,bytes,ns,ns_per_element,gb_per_s\n");
 
-	/* Error while opening file. */
-	if(output==NULL)
+	for(long long width=1000000; width<=max_width; width*=10)
 	{
-		cout<<"ERROR: could not open file "<<filename<<".\n";
-		exit(0);
-	}
+		for(double density : densities)
+		{
+			for(int skew=SKEW_UNIFORM; skew<=SKEW_LINEAR; skew++)
+			{
+				uint64_t members = generate_file(names[0], width, density, skew);
+				members += generate_file(names[1], width, density, skew);
+				uint64_t input_bytes = file_bytes(names[0])+file_bytes(names[1]);
 
-	/* if the set contains a number in the range, write to file. */
-	for(int i=range_start; i<=range_end; i++)
-		if(s.contains(i))
-			fprintf(output, "%d\n", i);
+				range_start = 0;
+				range_end = width-1;
+				set a, b;
 
-	/* closing the file. */
-	fclose(output);
+				double best = 1e30;
+				for(int run=0; run<runs; run++)
+				{
+					set x, y;
+					vector<string> files(names, names+2);
+					vector<set*> sets;
+					sets.push_back(&x);
+					sets.push_back(&y);
+
+					double start = now_ns();
+					create_sets(files, sets);
+					best = min(best, now_ns()-start);
+
+					a = std::move(x);
+					b = std::move(y);
+				}
+				report(width, density, skew, "ingest", members, input_bytes, best);
+
+				/* each operation reads two sets and writes one. */
+				uint64_t op_bytes = 3*8*a.word_count();
+				const char *ops[] = {"union", "intersection", "difference", "sym_difference"};
+				for(int op=0; op<4; op++)
+				{
+					best = 1e30;
+					for(int run=0; run<runs; run++)
+					{
+						double start = now_ns();
+						set c = op==0 ? a.set_union(b) : op==1 ? a.set_intersection(b) :
+							op==2 ? a.set_difference(b) : a.set_set_difference(b);
+						best = min(best, now_ns()-start);
+					}
+					report(width, density, skew, ops[op], width, op_bytes, best);
+				}
+
+				set c = a.set_union(b);
+				uint64_t written = c.cardinality();
+				best = 1e30;
+				for(int run=0; run<runs; run++)
+				{
+					double start = now_ns();
+					write_set(output, c);
+					best = min(best, now_ns()-start);
+				}
+				report(width, density, skew, "output", written, file_bytes(output), best);
+			}
+		}
+	}
+
+	unlink(names[0].c_str());
+	unlink(names[1].c_str());
+	unlink(output.c_str());
 }
 
 /*
- * This function checks if the command line arguments are passed or not.
- * If not, this asks for the arguments.
+ * The benchmark prints CSV on stdout, so runs of different commits can be compared.
+ * 	set_benchmark [max_width [directory [runs]]]: the grid, up to 10^8 in /tmp with 3 runs by default.
+ * 	set_benchmark --construction: the construction of empty sets.
+ * The options of the tool, as --threads n, are also taken.
  */
-void check_arguments(int args)
-{	
-	/* if the range is not passed. */
-    if(args<2)
+int main(int args, char **argc)
+{
+	vector<char*> rest;
+	for(int i=1; i<args; i++)
+	{
+		if(strcmp(argc[i], "--construction")==0)
+		{
+			benchmark_construction();
+			return 0;
+		}
+		if(parse_value_option(i, args, argc))
+			continue;
+		if(strncmp(argc[i], "--", 2)==0)
+			parse_option(argc[i]);
+		else
+			rest.push_back(argc[i]);
+	}
+
+	long long max_width = rest.size()>0 ? atoll(rest[0]) : 100000000LL;
+	string dir = rest.size()>1 ? rest[1] : "/tmp";
+	int runs = rest.size()>2 ? max(1, atoi(rest[2])) : 3;
+	if(max_width<1000000 || max_width>INT_MAX)
+	{
+		cout<<"ERROR: Invalid arguments!\n";
+		exit(0);
+	}
+
+	benchmark_grid(max_width, dir, runs);
+	return 0;
+}
+#else
+/*
+ * This function runs the part of main() for the modes that are one phase, measured with --stats.
+ * @param name: the name of the phase.
+ * @param run: the function of the mode.
+ */
+void run_mode(const char *name, void (*run)())
+{
+	if(stats)
+		stats->begin(name);
+	run();
+	if(stats)
+		stats->end(batch_file=="" ? input_bytes() : 0, output_file=="" ? 0 : file_bytes(output_file), 0);
+}
+
+int main(int args, char **argc)
+{
+	/* Parse command line arguments. */
+    int given = parse_arguments(args, argc);
+
+    /* checking for all the arguments, the other modes are always given all of them. */
+    if(input_files.empty() && batch_file=="")
+        check_arguments(given);
+
+    /* only one of the inputs can be read from the standard input. */
+    vector<string> inputs = input_files;
+    inputs.push_back(input_file1);
+    if(operation!=14)
+        inputs.push_back(input_file2);
+    if(count(inputs.begin(), inputs.end(), string("-"))>1)
     {
-        cout<<"Enter the range (\"start-end\"): ";
-        string range;
-        cin>>range;
+        cout<<"ERROR: Invalid arguments!\n";
+        exit(0);
+    }
 
-        parse_range((char*)range.c_str());
-        args++;
+    /* convert reads one file of any order, it is not a merge of sorted files. */
+    if(operation==14 && sorted_inputs)
+    {
+        cout<<"ERROR: Invalid arguments!\n";
+        exit(0);
     }
 
-    /* if the operation to be performed is not passed. */
-    if(args<3)
+    /* the report is made when the run returns from main(). */
+    unique_ptr<run_stats> report;
+    if(show_stats || stats_file!="")
     {
-        cout<<"Enter the opration: ";
-        string op;
-        cin>>op;
-        parse_operation((char*)op.c_str());
-        args++;
+        report.reset(new run_stats());
+        stats = report.get();
     }
 
-    /* if the first input file is not passed. */
-    if(args<4)
+    /* updating a saved result with the deltas of its inputs. */
+    if(delta_result!="")
     {
-        cout<<"Enter the first input file: ";
-        cin>>input_file1;
-        args++;
+        run_mode("delta", run_delta);
+        return 0;
     }
 
-    /* if the second input file is not passed. */
-    if(args<5)
+    /* combining any number of files at once. */
+    if(kway || at_least>0)
     {
-        cout<<"Enter the second input file: ";
-        cin>>input_file2;
-        args++;
+        run_mode("kway", run_kway);
+        return 0;
     }
 
-    /* if the output file is not passed. */
-    if(args<6)
+    /* sorted files are merged, without the limits of the sets. */
+    if(sorted_inputs && expression=="" && batch_file=="")
     {
-        cout<<"Enter the output file: ";
-        cin>>output_file;
+        run_mode("merge", merge_sorted);
+        return 0;
     }
-}
 
-/* 
- * This function performs the desired operation.
- */
-set set_operation(set a, set b)
-{
-    set c;
+    /* running the commands of a script. */
+    if(batch_file!="")
+    {
+        run_mode("batch", run_batch);
+        return 0;
+    }
 
-    /* checking the operation to be performed. */
-    if(operation==1)
-        c = a.set_union(b);
-    else if(operation==2)
-        c = a.set_intersection(b);
-    else if(operation==3)
-        c = a.set_difference(b);
-    else
-        c = a.set_set_difference(b);
+    /* evaluating an expression over many files. */
+    if(expression!="")
+    {
+        run_mode("expression", run_expression);
+        return 0;
+    }
 
-    return c;
-}
+    /* converting a file between text and binary. */
+    if(operation==14)
+    {
+        run_mode("convert", run_convert);
+        return 0;
+    }
 
-int main(int args, char **argc)
-{
-	/* Parse command line arguments. */
-    parse_arguments(args, argc);
+    if(use_sparse_sets())
+    {
+        /* creating sets from file. */
+        if(stats)
+            stats->begin("load");
+        sparse_set a, b;
+        create_set(input_file1, &a);
+        create_set(input_file2, &b);
+        a.optimize();
+        b.optimize();
+        if(stats)
+            stats->end(input_bytes(), 0, a.cardinality()+b.cardinality());
 
-    /* checking for all the arguments. */
-    check_arguments(args);
+        /* answering a query, or performing a operation, the result is stored in a. */
+        if(stats)
+            stats->begin("operation");
+        if(operation>4)
+            write_query(output_file, a, b, operation);
+        else
+            set_operation(a, b, operation);
+        if(stats)
+            stats->end(0, operation>4 ? file_bytes(output_file) : 0, a.container_count()+b.container_count());
+
+        if(operation<=4)
+        {
+            if(stats)
+                stats->begin("write");
+            write_output(output_file, a);
+            if(stats)
+                stats->end(0, file_bytes(output_file), a.cardinality());
+        }
+        return 0;
+    }
 
     set a, b;
-	int len = range_end-range_start+1;
 
     /* creating sets from file. */
-    create_set(input_file1, &a);
-    create_set(input_file2, &b);
+    if(stats)
+        stats->begin("load");
+    vector<string> names;
+    names.push_back(input_file1);
+    names.push_back(input_file2);
+    vector<set*> sets;
+    sets.push_back(&a);
+    sets.push_back(&b);
+    create_sets(names, sets);
+    if(stats)
+        stats->end(input_bytes(), 0, a.cardinality()+b.cardinality());
 
-    /* performing a operation */
-    set c = set_operation(a, b);
-    write_set(output_file, c);
+    /* answering a query, or performing a operation, the result is stored in a. */
+    if(stats)
+        stats->begin("operation");
+    if(operation>4)
+        write_query(output_file, a, b, operation);
+    else
+        set_operation(a, b, operation);
+    if(stats)
+        stats->end(0, operation>4 ? file_bytes(output_file) : 0, range_last()+1);
+
+    if(operation<=4)
+    {
+        if(stats)
+            stats->begin("write");
+        write_output(output_file, a);
+        if(stats)
+            stats->end(0, file_bytes(output_file), a.cardinality());
+    }
 
     return 0;
 }
+#endif
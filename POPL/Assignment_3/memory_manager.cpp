@@ -2,50 +2,649 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 #include <vector>
-#include <map>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 #define max_blocks 10000000
 #define ll long long int
-#define pr pair<ll, Registry>
+
+/*
+ * An id is the index of the registry element in the registry table, and the generation of the
+ * element when it was allocated: id = generation<<index_bits | index.
+ * The table has an element for each block of the largest buffer. The generation wraps after
+ * 2^39 frees of the same element, so an old id does not become valid again in practice.
+ * The links stored in the buffer by the list are indices, see link_id().
+ */
+#define index_bits 24
+#define max_registry (1<<index_bits)
+#define generation_mask ((1LL<<(63-index_bits))-1)
+
+/*
+ * The registry table is allocated in chunks of chunk_size elements, so the elements are never
+ * moved and the threads can find them without a lock.
+ */
+#define chunk_bits 12
+#define chunk_size (1<<chunk_bits)
+
+/*
+ * Free blocks are kept in lists by size class: a class for each size up to exact_classes,
+ * and a class for each power of 2 above it.
+ */
+#define exact_classes 16
+#define size_classes (exact_classes+32)
+
+/*
+ * Each thread keeps at most cache_limit free blocks of each exact class, and free registry elements,
+ * and takes refill_count of them at a time from the shared lists.
+ */
+#define cache_limit 256
+#define refill_count 32
 
 using namespace std;
 
+/*
+ * A trace function finds the ids stored in a block, it is registered for the block with register_trace().
+ * When the block is freed, the blocks of these ids are released too.
+ * @param block: the memory of the block.
+ * @param size: the size of the block.
+ * @param children: the ids are added to it.
+ */
+typedef void (*trace_function)(int *block, int size, vector<ll> &children);
+
 int *buffer = NULL;
-ll next_id = 0;
 int total_size;
 int current_index;
-int dummy_memory;
+thread_local int dummy_memory;
 
 /*
  * This class maintains the registry of all the allocated blocks in the buffer.
  * @data memory_index: it stores the index of the allocated block in buffer.
  * @data block_size: it stores the size of the allocated block.
  * @data reference_count: it stores the count of references to the block.
+ * @data generation: it is changed each time the element is freed, so the old ids are not valid.
+ * @data used: it is false for a free element of the registry table.
+ * @data trace: the trace function of the block, or NULL.
  */
 class Registry
 {
 	public:
 		int memory_index;
 		int block_size;
-		int reference_count;
+		atomic<int> reference_count;
+		atomic<ll> generation;
+		atomic<bool> used;
+		trace_function trace;
+
+		/* Constructor for a free element of the registry table. */
+		Registry()
+		{
+			memory_index = 0;
+			block_size = 0;
+			reference_count = 0;
+			generation = 0;
+			used = false;
+			trace = NULL;
+		}
 
 		/*
-		 * Constructor for the objects.
-		 * @param inde: the index of the memory block allocated.
+		 * This function sets the element for an allocated block.
+		 * @param index: the index of the memory block allocated.
 		 * @param size: the size of the block allocated.
 		 * It sets the reference count as 1.
 		 */
-		Registry(int index, int size)
+		void allocate(int index, int size)
 		{
 			memory_index = index;
 			block_size = size;
-			reference_count = 1;
+			trace = NULL;
+			reference_count.store(1, memory_order_relaxed);
+			used.store(true, memory_order_release);
+		}
+};
+
+/*
+ * The chunks of the registry table, the number of its elements, and the indices of its free elements.
+ * The buffer, the registry table and the shared free lists are changed with manager_lock.
+ */
+Registry *registry_table[max_registry/chunk_size];
+atomic<int> registry_size(0);
+vector<int> free_registry;
+mutex manager_lock;
+
+/*
+ * This function returns an element of the registry table.
+ * @param index: the index of the element.
+ */
+inline Registry& registry_element(int index)
+{
+	return registry_table[index>>chunk_bits][index&(chunk_size-1)];
+}
+
+/*
+ * This function finds the registry element of an id.
+ * @param id: the id of the registry element.
+ * @return Registry*: the element, or NULL if the id is not valid or the element was freed.
+ */
+inline Registry* find_registry(ll id)
+{
+	if(id<0)
+		return NULL;
+
+	ll index = id&(max_registry-1);
+	if(index>=registry_size.load(memory_order_acquire))
+		return NULL;
+
+	Registry *it = &registry_element(index);
+	if(!it->used.load(memory_order_relaxed) || it->generation.load(memory_order_relaxed)!=(id>>index_bits))
+		return NULL;
+	return it;
+}
+
+/*
+ * A link is the index of a registry element stored in the buffer, or -1. The block holding a link
+ * holds a reference to its element, so the element is used and its generation is current.
+ * @param id: the id of the registry element, or -1.
+ * @return int: the link to the element.
+ */
+inline int link(ll id)
+{
+	return id<0 ? -1 : (int)(id&(max_registry-1));
+}
+
+/*
+ * This function finds the id of the registry element of a link.
+ * @param index: the link.
+ * @return ll: the id of the element, or -1.
+ */
+inline ll link_id(int index)
+{
+	if(index<0 || index>=registry_size.load(memory_order_acquire))
+		return -1;
+	return (registry_element(index).generation.load(memory_order_relaxed)<<index_bits)|index;
+}
+
+/*
+ * block_owner[i] is the index in the registry table of the block starting at i in the buffer,
+ * or -size if a free block of the size starts at i.
+ */
+vector<int> block_owner;
+
+/* The shared lists of the memory indices of the free blocks, by size class. */
+vector<int> free_blocks[size_classes];
+
+/*
+ * The shared lists of the free blocks not compacted yet by the running compaction, by size class.
+ * They are reused until the compaction passes them, the indices before compact_from are removed
+ * when they are found.
+ */
+vector<int> ahead_blocks[size_classes];
+
+/*
+ * State of the incremental compaction.
+ * The blocks before compact_from in the buffer have been moved down before compact_to.
+ * It is changed only when all the threads are stopped, see stop_the_world().
+ * The compaction is a fallback for fragmentation: an allocation compacts the memory only when no
+ * free block is large enough and the end of the buffer is too small, see allocate_registry().
+ */
+bool compacting = false;
+int compact_from, compact_to;
+
+/* The number of blocks visited by a step of the compaction, no bound if it is 0. */
+int compaction_budget = 64;
+
+/*
+ * This function finds the size class of a block.
+ * @param size: the size of the block, more than 0.
+ * @return int: the size class.
+ */
+int size_class(int size)
+{
+	if(size<=exact_classes)
+		return size-1;
+	return exact_classes+(31-__builtin_clz(size))-4;
+}
+
+/*
+ * This class maintains a histogram of latencies in nanoseconds, with a bucket for each power of 2.
+ * It is recorded by one thread at a time, and can be read by all the threads.
+ * @data bucket: bucket[i] counts the latencies in (2^(i-1), 2^i].
+ * @data count: the number of latencies recorded.
+ * @data max_latency: the largest latency recorded.
+ */
+class Histogram
+{
+	public:
+		atomic<ll> bucket[64];
+		atomic<ll> count;
+		atomic<ll> max_latency;
+
+		Histogram()
+		{
+			for(int i=0; i<64; i++)
+				bucket[i] = 0;
+			count = 0;
+			max_latency = 0;
+		}
+
+		/*
+		 * This function records a latency.
+		 * @param ns: the latency in nanoseconds.
+		 */
+		void record(ll ns)
+		{
+			atomic<ll> &b = bucket[ns<=1 ? 0 : 64-__builtin_clzll(ns-1)];
+			b.store(b.load(memory_order_relaxed)+1, memory_order_relaxed);
+			count.store(count.load(memory_order_relaxed)+1, memory_order_relaxed);
+			if(ns>max_latency.load(memory_order_relaxed))
+				max_latency.store(ns, memory_order_relaxed);
+		}
+
+		/*
+		 * This function adds the latencies of another histogram.
+		 * @param h: the histogram.
+		 */
+		void add(Histogram &h)
+		{
+			for(int i=0; i<64; i++)
+				bucket[i].store(bucket[i].load(memory_order_relaxed)+h.bucket[i].load(memory_order_relaxed), memory_order_relaxed);
+			count.store(count.load(memory_order_relaxed)+h.count.load(memory_order_relaxed), memory_order_relaxed);
+			if(h.max_latency.load(memory_order_relaxed)>max_latency.load(memory_order_relaxed))
+				max_latency.store(h.max_latency.load(memory_order_relaxed), memory_order_relaxed);
+		}
+
+		/*
+		 * This function finds a percentile of the recorded latencies.
+		 * @param p: the percentile, between 0 and 100.
+		 * @return ll: the upper bound of the bucket of the percentile, in nanoseconds.
+		 */
+		ll percentile(double p)
+		{
+			ll rank = (ll)(p*count/100);
+			if(rank>=count)
+				rank = count-1;
+
+			ll seen = 0;
+			for(int i=0; i<64; i++)
+			{
+				seen += bucket[i];
+				if(seen>rank)
+					return min(1LL<<i, max_latency.load());
+			}
+			return max_latency;
+		}
+
+		/*
+		 * This function prints the summary of the histogram.
+		 * @param name: the name of the latencies.
+		 */
+		void show(const char *name)
+		{
+			cout<<name<<": "<<count;
+			if(count>0)
+				cout<<" p50 "<<percentile(50)<<"ns p99 "<<percentile(99)<<"ns p99.9 "<<percentile(99.9)<<"ns max "<<max_latency<<"ns";
+			cout<<endl;
+		}
+};
+
+/*
+ * Latencies of the steps of the compaction, recorded with manager_lock, and of my_new() in the
+ * threads that have exited. The threads record my_new() in their caches, see show_latency().
+ */
+Histogram pause_latency, exited_allocation_latency;
+
+/* This function returns the time of a monotonic clock in nanoseconds. */
+ll now_ns()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (ll)t.tv_sec*1000000000LL+t.tv_nsec;
+}
+
+/*
+ * Safepoints: a compaction moves blocks only when all the other threads using the memory are in
+ * a safe region, where they do not hold memory indices or references returned by MyInt::operator[].
+ * A thread is attached by its first access to the memory, and it accesses the memory until the end
+ * of the AccessScope it is in. It is in a safe region until its next access, in safepoint(),
+ * which is called by MyInt::operator[], MyInt::update_id(), my_new() and my_delete(), while it
+ * waits for manager_lock, and in the scope of a SafeRegion object. So a reference returned by
+ * MyInt::operator[] is valid until the next of these calls, or the end of the AccessScope.
+ * A compaction waits at most stop_timeout_ms for the threads, else it is postponed until the
+ * threads that did not stop enter a safe region.
+ * @data attached_threads: the number of threads using the memory.
+ * @data safe_threads: the number of those threads in a safe region.
+ * @data stop_requested: true while a thread waits for the others to stop, or moves blocks.
+ */
+#define stop_timeout_ms 100
+
+class ThreadCache;
+vector<ThreadCache*> thread_caches;
+mutex safepoint_lock;
+condition_variable safepoint_cv;
+int attached_threads = 0;
+int safe_threads = 0;
+atomic<bool> stop_requested(false);
+
+/*
+ * This class keeps free blocks and free registry elements of a thread, so most allocations
+ * and frees of the thread do not take manager_lock.
+ * A thread is attached when its cache is created, and detached when it exits.
+ * @data blocks: blocks[c] are the memory indices of the free blocks of size c+1.
+ * @data registry: the indices of the free registry elements.
+ * @data allocation_latency: the latencies of my_new() in the thread.
+ * @data safe_depth: the number of safe regions the thread is in, it is safe while it is more than 0.
+ * @data idle: true when the thread is in a safe region until its next access to the memory.
+ * @data missed_stop: true when the thread did not stop for a compaction, until it is in a safe region.
+ */
+class ThreadCache
+{
+	public:
+		vector<int> blocks[exact_classes];
+		vector<int> registry;
+		Histogram allocation_latency;
+		int safe_depth;
+		bool idle;
+		bool missed_stop;
+
+		/* the thread is attached in a safe region, until its first access. */
+		ThreadCache()
+		{
+			lock_guard<mutex> lock(safepoint_lock);
+			safe_depth = 1;
+			idle = true;
+			missed_stop = false;
+			attached_threads++;
+			safe_threads++;
+			thread_caches.push_back(this);
+		}
+
+		/* This function enters a safe region. */
+		void enter_safe_region()
+		{
+			lock_guard<mutex> lock(safepoint_lock);
+			if(safe_depth++==0)
+			{
+				safe_threads++;
+				missed_stop = false;
+				safepoint_cv.notify_all();
+			}
+		}
+
+		/* This function leaves a safe region, after the running compaction step. */
+		void leave_safe_region()
+		{
+			unique_lock<mutex> lock(safepoint_lock);
+			if(safe_depth==1)
+			{
+				while(stop_requested.load())
+					safepoint_cv.wait(lock);
+				safe_threads--;
+			}
+			safe_depth--;
+		}
+
+		/* giving back the free blocks and registry elements to the shared lists. */
+		~ThreadCache()
+		{
+			enter_safe_region();
+			manager_lock.lock();
+			leave_safe_region();
+
+			for(int c=0; c<exact_classes; c++)
+				free_blocks[c].insert(free_blocks[c].end(), blocks[c].begin(), blocks[c].end());
+			free_registry.insert(free_registry.end(), registry.begin(), registry.end());
+
+			{
+				lock_guard<mutex> lock(safepoint_lock);
+				attached_threads--;
+				if(safe_depth>0)
+					safe_threads--;
+				exited_allocation_latency.add(allocation_latency);
+				thread_caches.erase(find(thread_caches.begin(), thread_caches.end(), this));
+			}
+			manager_lock.unlock();
+		}
+};
+
+/* This function returns the cache of the thread, and attaches the thread on the first call. */
+ThreadCache& thread_cache()
+{
+	thread_local ThreadCache cache;
+	return cache;
+}
+
+/*
+ * This function starts an access of the thread to the memory if it is idle, and waits here if
+ * another thread is stopping the threads.
+ */
+void safepoint()
+{
+	ThreadCache &cache = thread_cache();
+	if(cache.idle)
+	{
+		cache.idle = false;
+		cache.leave_safe_region();
+	}
+	else if(stop_requested.load(memory_order_acquire))
+	{
+		cache.enter_safe_region();
+		cache.leave_safe_region();
+	}
+}
+
+/*
+ * This function stops all the other threads in a safe region, it is called with manager_lock.
+ * @return bool: false if they did not stop within stop_timeout_ms, they are not stopped then.
+ */
+bool stop_the_world()
+{
+	ThreadCache *self = &thread_cache();
+	unique_lock<mutex> lock(safepoint_lock);
+	for(int i=0; i<(int)thread_caches.size(); i++)
+		if(thread_caches[i]!=self && thread_caches[i]->missed_stop)
+			return false;
+
+	stop_requested = true;
+	int others = attached_threads-1+(self->safe_depth>0);
+	if(safepoint_cv.wait_for(lock, chrono::milliseconds(stop_timeout_ms), [others]{ return safe_threads>=others; }))
+		return true;
+
+	/* the compaction is postponed until the threads that did not stop are in a safe region. */
+	for(int i=0; i<(int)thread_caches.size(); i++)
+		if(thread_caches[i]!=self && thread_caches[i]->safe_depth==0)
+			thread_caches[i]->missed_stop = true;
+	stop_requested = false;
+	safepoint_cv.notify_all();
+	return false;
+}
+
+/* This function lets the stopped threads continue. */
+void resume_the_world()
+{
+	lock_guard<mutex> lock(safepoint_lock);
+	stop_requested = false;
+	safepoint_cv.notify_all();
+}
+
+/* This function takes manager_lock, in a safe region while it waits. */
+void lock_manager()
+{
+	ThreadCache &cache = thread_cache();
+	if(manager_lock.try_lock())
+		return;
+
+	cache.enter_safe_region();
+	manager_lock.lock();
+	cache.leave_safe_region();
+}
+
+/*
+ * An object of this class keeps the thread in a safe region, e.g. around a join or a long wait,
+ * so the other threads can compact the memory meanwhile.
+ */
+class SafeRegion
+{
+	public:
+		SafeRegion()
+		{
+			thread_cache().enter_safe_region();
+		}
+
+		~SafeRegion()
+		{
+			thread_cache().leave_safe_region();
+		}
+};
+
+/*
+ * An object of this class is a scope of accesses to the memory, e.g. a function of the list.
+ * At its end the thread holds no memory index or reference returned by MyInt::operator[], so it is
+ * idle in a safe region until its next access, and a compaction does not wait for it.
+ */
+class AccessScope
+{
+	public:
+		~AccessScope()
+		{
+			ThreadCache &cache = thread_cache();
+			if(!cache.idle)
+			{
+				cache.idle = true;
+				cache.enter_safe_region();
+			}
 		}
 };
 
-map<ll, Registry> registry_map;
+/*
+ * This function gives back half of the free blocks of a class in the cache to the shared list.
+ * @param cache: the cache of the thread.
+ * @param c: the size class.
+ */
+void give_back_blocks(ThreadCache &cache, int c)
+{
+	lock_manager();
+	vector<int> &blocks = cache.blocks[c];
+	int keep = blocks.size()/2;
+	free_blocks[c].insert(free_blocks[c].end(), blocks.begin()+keep, blocks.end());
+	blocks.resize(keep);
+	manager_lock.unlock();
+}
+
+/*
+ * This function keeps a free block in the shared lists, it is called with manager_lock.
+ * A block not compacted yet by the running compaction is kept in ahead_blocks.
+ * @param memory_index: the index of the block in the buffer.
+ * @param size: the size of the block.
+ */
+void list_free_block(int memory_index, int size)
+{
+	block_owner[memory_index] = -size;
+	if(!compacting || memory_index<compact_to)
+		free_blocks[size_class(size)].push_back(memory_index);
+	else
+		ahead_blocks[size_class(size)].push_back(memory_index);
+}
+
+/*
+ * This function marks the block of a freed registry element as free, and keeps it for reuse.
+ * @param cache: the cache of the thread.
+ * @param it: the registry element.
+ */
+void free_block(ThreadCache &cache, Registry *it)
+{
+	int size = it->block_size;
+	if(size<=0)
+		return;
+
+	/* the small blocks are kept in the cache of the thread, if they are not moved by the running compaction. */
+	if(size<=exact_classes && (!compacting || it->memory_index<compact_to))
+	{
+		block_owner[it->memory_index] = -size;
+		cache.blocks[size-1].push_back(it->memory_index);
+		if(cache.blocks[size-1].size()>cache_limit)
+			give_back_blocks(cache, size-1);
+		return;
+	}
+
+	/* the block can be moved while waiting for the lock, so its memory index is read after it. */
+	lock_manager();
+	int memory_index = it->memory_index;
+
+	/* if it is the last block, the memory is given back to the end of the buffer. */
+	if(!compacting && memory_index+size==current_index)
+		current_index = memory_index;
+	else
+		list_free_block(memory_index, size);
+	manager_lock.unlock();
+}
+
+/*
+ * This function frees a registry element with no references left, and its block.
+ * The ids of the element are no longer valid.
+ * @param cache: the cache of the thread.
+ * @param id: the id of the registry element.
+ * @param it: the registry element.
+ * @param children: the ids stored in the block are added to it, by the trace function of the block.
+ */
+void free_registry_element(ThreadCache &cache, ll id, Registry *it, vector<ll> &children)
+{
+	if(it->trace!=NULL && it->block_size>0)
+		it->trace(buffer+it->memory_index, it->block_size, children);
+
+	it->used.store(false, memory_order_relaxed);
+	free_block(cache, it);
+
+	it->generation.store((it->generation.load(memory_order_relaxed)+1)&generation_mask, memory_order_relaxed);
+
+	/* keeping the registry element in the cache of the thread. */
+	cache.registry.push_back(id&(max_registry-1));
+	if(cache.registry.size()>cache_limit)
+	{
+		lock_manager();
+		int keep = cache.registry.size()/2;
+		free_registry.insert(free_registry.end(), cache.registry.begin()+keep, cache.registry.end());
+		cache.registry.resize(keep);
+		manager_lock.unlock();
+	}
+}
+
+/*
+ * This function decreases the reference count of a registry element.
+ * The element and its block are freed when no reference is left, and the blocks referenced
+ * by the block are released in turn, without recursion so long lists can be freed.
+ * @param id: the id of the registry element.
+ * @return bool: false if the id is not valid.
+ */
+bool release_registry(ll id)
+{
+	Registry *it = find_registry(id);
+	if(it==NULL)
+		return false;
+
+	/* the block is read and freed, the thread accesses the memory. */
+	safepoint();
+	if(it->reference_count.fetch_sub(1, memory_order_acq_rel)>1)
+		return true;
+
+	ThreadCache &cache = thread_cache();
+	vector<ll> children;
+	free_registry_element(cache, id, it, children);
+
+	while(!children.empty())
+	{
+		ll child = children.back();
+		children.pop_back();
+
+		it = find_registry(child);
+		if(it!=NULL && it->reference_count.fetch_sub(1, memory_order_acq_rel)==1)
+			free_registry_element(cache, child, it, children);
+	}
+	return true;
+}
 
 /*
  * This class defines objects that store the id of the allocated registry element. 
@@ -69,26 +668,24 @@ class MyInt
 			this->id = b.id;
 
 			/* increasing the reference count of the object being copied. */
-			map<ll, Registry>::iterator it = registry_map.find(b.id);
-			if(it!=registry_map.end())
-				it->second.reference_count++;
+			Registry *it = find_registry(b.id);
+			if(it!=NULL)
+				it->reference_count++;
 		}
 
 		/* overloading the assignment operator for the objects. */
 		MyInt& operator=(MyInt const &b)
 		{
+			/* updating the reference count for the rvalue, before the lvalue may free it. */
+			Registry *it = find_registry(b.id);
+			if(it!=NULL)
+				it->reference_count++;
+
 			/* updating the reference count for the lvalue. */
-			map<ll, Registry>::iterator it = registry_map.find(this->id);
-			if(it!=registry_map.end())
-			{
-				it->second.reference_count--;
-			}
+			release_registry(this->id);
 
-			/* updating the reference count for the rvalue. */
-			it = registry_map.find(b.id);
-			if(it!=registry_map.end())
+			if(it!=NULL)
 			{
-				it->second.reference_count++;
 				this->id = b.id;
 			}
 			else
@@ -102,14 +699,17 @@ class MyInt
 		/* overloading the [] operator for objects for access. */
 		int& operator[](const int &index)
 		{
+			/* the block is not moved after the safepoint, until the next one. */
+			safepoint();
+
 			/* indexing the memory allocated. */
-			map<ll, Registry>::iterator it = registry_map.find(this->id);
+			Registry *it = find_registry(this->id);
 
-			if(it!=registry_map.end())
+			if(it!=NULL)
 			{	
 				/* if out of bounds access. */
-				int memory_index = it->second.memory_index;
-				if(index>=it->second.block_size || index<0)
+				int memory_index = it->memory_index;
+				if(index>=it->block_size || index<0)
 				{
 					cout<<"ERROR: Memory out of bound being accessed. Prone to segmentation faults and erraneous results.\n";
 					return dummy_memory;
@@ -126,23 +726,22 @@ class MyInt
 			}
 		}
 
-		void update_id(int id)
+		void update_id(ll id)
 		{
-			map<ll, Registry>::iterator it = registry_map.find(this->id);
-			if(it!=registry_map.end())
-			{
-				it->second.reference_count--;
-			}
-			else
+			safepoint();
+
+			Registry *it = find_registry(id);
+			if(it!=NULL)
+				it->reference_count++;
+
+			if(!release_registry(this->id))
 			{
 				//cout<<"ERROR: The previous id not valid.\n";
 			}
 
-			it = registry_map.find(id);
-			if(it!=registry_map.end())
+			if(it!=NULL)
 			{
 				this->id = id;
-				it->second.reference_count++;
 			}
 			else
 			{
@@ -154,15 +753,25 @@ class MyInt
 		/* Destructor for the objects. */
 		~MyInt()
 		{
-			map<ll, Registry>::iterator it = registry_map.find(this->id);
-
-			if(it!=registry_map.end())
-				it->second.reference_count--;
+			release_registry(this->id);
 		}
 };
 
-/* 
+/*
+ * This function registers the trace function of a block.
+ * @param block: the MyInt of the block.
+ * @param trace: the trace function.
+ */
+void register_trace(MyInt &block, trace_function trace)
+{
+	Registry *it = find_registry(block.id);
+	if(it!=NULL)
+		it->trace = trace;
+}
+
+/*
  * This function creates a memory buffer which is used for allocation in the program.
+ * It is called before the threads use the memory.
  * @param size: the number of blocks to be allocated.
  */
 void create_buffer(int size)
@@ -178,6 +787,7 @@ void create_buffer(int size)
 	buffer = (int*)malloc(sizeof(int)*size);
 	total_size = size;
 	current_index = 0;
+	block_owner.resize(size);
 
 	/* If memory could not be allocated. */
 	if(buffer==NULL)
@@ -187,122 +797,353 @@ void create_buffer(int size)
 	}
 }
 
+/*
+ * This function finds a free element of the registry table, it is called with manager_lock.
+ * @return int: the index of the element, -1 if the registry table is full.
+ */
+int new_registry_index()
+{
+	if(!free_registry.empty())
+	{
+		int index = free_registry.back();
+		free_registry.pop_back();
+		return index;
+	}
+
+	/* Growing the table, with a new chunk if the last one is full. */
+	int index = registry_size.load(memory_order_relaxed);
+	if(index>=max_registry)
+		return -1;
+	if((index&(chunk_size-1))==0)
+		registry_table[index>>chunk_bits] = new Registry[chunk_size];
+	registry_size.store(index+1, memory_order_release);
+	return index;
+}
+
+/*
+ * This function sets a registry element for a block.
+ * @param index: the index of the element in the registry table.
+ * @param memory_index: the index of the block in the buffer.
+ * @param size: the size of the block.
+ * @return ll: the id of the registry element.
+ */
+ll set_registry(int index, int memory_index, int size)
+{
+	Registry &element = registry_element(index);
+	element.allocate(memory_index, size);
+	if(size>0)
+		block_owner[memory_index] = index;
+
+	return (element.generation.load(memory_order_relaxed)<<index_bits)|index;
+}
+
+/*
+ * This function inserts a registry element for a block, it is called with manager_lock.
+ * @param memory_index: the index of the block in the buffer.
+ * @param size: the size of the block.
+ * @return ll: the id of the registry element, -1 if the registry table is full.
+ */
+ll insert_registry(int memory_index, int size)
+{
+	int index = new_registry_index();
+	if(index<0)
+		return -1;
+	return set_registry(index, memory_index, size);
+}
+
+/*
+ * This function allocates a block from the end of the buffer.
+ * @return ll: the id of the registry element, -1 if the registry table is full.
+ */
 ll allocate_from_buffer(int size)
 {
-	/* Creating new Registry element allocated from current_index and of given size. */
-	Registry new_registry_element(current_index, size);
+	ll id = insert_registry(current_index, size);
 
 	/* Updating the current index. */
-	current_index = current_index+size;
+	if(id>=0)
+		current_index = current_index+size;
+	return id;
+}
+
+/*
+ * This function allocates a block from the shared free blocks, it is called with manager_lock.
+ * The block is taken from the class of the size, or split from a block of a larger class.
+ * The blocks not compacted yet by the running compaction are used after the others.
+ * @return ll: the id of the registry element, -1 if no free block is large enough.
+ */
+ll allocate_from_free_list(int size)
+{
+	vector<int> *lists[2] = {free_blocks, ahead_blocks};
+	for(int l=0; l<2; l++)
+	{
+		for(int c=size_class(size); c<size_classes; c++)
+		{
+			vector<int> &blocks = lists[l][c];
 
-	/* Inserting the new registry element in the map. */
-	registry_map.insert(pr(next_id, new_registry_element));
+			/* the blocks passed by the running compaction are not free any more. */
+			while(lists[l]==ahead_blocks && !blocks.empty() && blocks.back()<compact_from)
+				blocks.pop_back();
 
-	/* Updating the next id to be allcated. */
-	next_id++;
+			/* the blocks of a power of 2 class can be smaller than the size. */
+			if(blocks.empty() || -block_owner[blocks.back()]<size)
+				continue;
 
-	/* returning the id of the allocated registry element. */
-	return next_id-1;
+			int memory_index = blocks.back();
+			int block_size = -block_owner[memory_index];
+
+			ll id = insert_registry(memory_index, size);
+			if(id<0)
+				return -1;
+			blocks.pop_back();
+
+			/* keeping the rest of the block. */
+			if(block_size>size)
+				list_free_block(memory_index+size, block_size-size);
+			return id;
+		}
+	}
+	return -1;
 }
 
-/* Comparison function to sort the vector of registry elements. */
-bool comp(pr i, pr j)
+/*
+ * This function refills the cache of the thread for a size, from the shared free blocks, or
+ * from the end of the buffer if no compaction is running.
+ * @param cache: the cache of the thread.
+ * @param size: the size of the blocks, at most exact_classes.
+ * @return bool: true if the cache has a block of the size and a registry element.
+ */
+bool refill_cache(ThreadCache &cache, int size)
 {
-	/* return true if the memory index of the first element is smaller. */
-	return i.second.memory_index<j.second.memory_index;
+	lock_manager();
+	vector<int> &blocks = cache.blocks[size-1];
+	vector<int> &shared = free_blocks[size-1];
+
+	while(blocks.size()<refill_count && !shared.empty())
+	{
+		blocks.push_back(shared.back());
+		shared.pop_back();
+	}
+
+	while(blocks.size()<refill_count && !compacting && total_size-current_index>=size)
+	{
+		block_owner[current_index] = -size;
+		blocks.push_back(current_index);
+		current_index += size;
+	}
+
+	while(cache.registry.size()<refill_count)
+	{
+		int index = new_registry_index();
+		if(index<0)
+			break;
+		cache.registry.push_back(index);
+	}
+
+	manager_lock.unlock();
+	return !blocks.empty() && !cache.registry.empty();
 }
 
-/* This function does memory compaction. */
-void compact_memory()
+/*
+ * This function allocates a block of an exact class from the cache of the thread.
+ * @return ll: the id of the registry element, -1 if the cache could not be refilled.
+ */
+ll allocate_from_cache(int size)
 {
-	/* Creating a vector to store the current registry elements in the map. */
-	vector <pr> registry_vector;
+	ThreadCache &cache = thread_cache();
+	vector<int> &blocks = cache.blocks[size-1];
+	if((blocks.empty() || cache.registry.empty()) && !refill_cache(cache, size))
+		return -1;
+
+	int memory_index = blocks.back();
+	blocks.pop_back();
+	int index = cache.registry.back();
+	cache.registry.pop_back();
+
+	return set_registry(index, memory_index, size);
+}
 
-	/* Iterating over the map, and pushing elements into the vector. */
-	map<ll, Registry>::iterator it = registry_map.begin();
-	while(it!=registry_map.end())
+/*
+ * This function moves the free blocks of the caches of all the threads to ahead_blocks, so the
+ * caches only get the blocks compacted by the running compaction. It is called when the threads are stopped.
+ */
+void flush_caches()
+{
+	for(int i=0; i<(int)thread_caches.size(); i++)
 	{
-		if(it->second.reference_count>0)
-			registry_vector.push_back(make_pair(it->first, it->second));
-		it++;
+		for(int c=0; c<exact_classes; c++)
+		{
+			vector<int> &blocks = thread_caches[i]->blocks[c];
+			ahead_blocks[c].insert(ahead_blocks[c].end(), blocks.begin(), blocks.end());
+			blocks.clear();
+		}
 	}
+}
 
-	/* Sorting the vector by the memory index. */
-	sort(registry_vector.begin(), registry_vector.end(), comp);
+/*
+ * This function starts an incremental compaction from the beginning of the buffer.
+ * The free blocks are kept in ahead_blocks, and reused until the compaction passes them.
+ * It is called with manager_lock.
+ * @return bool: false if the threads could not be stopped, the compaction is not started then.
+ */
+bool start_compaction()
+{
+	if(!stop_the_world())
+		return false;
+
+	compacting = true;
+	compact_from = 0;
+	compact_to = 0;
+	for(int c=0; c<size_classes; c++)
+		ahead_blocks[c].swap(free_blocks[c]);
+	flush_caches();
+	resume_the_world();
+	return true;
+}
 
-	/* Compacting memory and moving memory blocks. */
-	ll cur_index = 0;
-	for(ll i=0; i<registry_vector.size(); i++)
+/*
+ * This function does a step of the compaction, with the other threads stopped.
+ * The next blocks in the buffer are moved down to the end of the compacted memory, and the free
+ * blocks are removed. The blocks allocated during the compaction are at the end of the buffer,
+ * so they are compacted by the same pass.
+ * It is called with manager_lock.
+ * @param budget: the number of blocks to be visited, no bound if it is 0.
+ * @return bool: true if the compaction is finished.
+ */
+bool compaction_step(int budget)
+{
+	if(!compacting)
+		return true;
+
+	/* the step is postponed if the threads could not be stopped. */
+	ll start = now_ns();
+	if(!stop_the_world())
+		return false;
+
+	for(int visited=0; compact_from<current_index && (budget<=0 || visited<budget); visited++)
 	{
-		/* If the cur_index is the one that is occupied. */
-		if(registry_vector[i].second.memory_index==cur_index)
+		int index = block_owner[compact_from];
+
+		/* If the block is free. */
+		if(index<0)
 		{
-			cur_index += registry_vector[i].second.block_size;
+			compact_from += -index;
+			continue;
 		}
 
+		Registry &element = registry_element(index);
+
 		/* If the memory block can be moved. */
-		else if(cur_index<registry_vector[i].second.memory_index)
+		if(element.memory_index!=compact_to)
 		{
 			/* Copying the data until the block size. */
-			for(ll j=0; j<registry_vector[i].second.block_size; j++)
+			for(ll j=0; j<element.block_size; j++)
 			{
-				buffer[cur_index+j] = buffer[registry_vector[i].second.memory_index + j];
+				buffer[compact_to+j] = buffer[element.memory_index + j];
 			}
 
 			/* Updating the memory index of the registry element. */
-			registry_vector[i].second.memory_index = cur_index;
-
-			/* Updating the current index to be allocated. */
-			cur_index += registry_vector[i].second.block_size;
+			element.memory_index = compact_to;
+			block_owner[compact_to] = index;
 		}
-	}
-
-	/* Updating the current index of the buffer to be allocated. */
-	current_index = cur_index;
 
-	/* Erasing all the elements in the map. */
-	registry_map.erase(registry_map.begin(), registry_map.end());
+		compact_from += element.block_size;
+		compact_to += element.block_size;
+	}
 
-	/* Inserting all the elements back into the map. */
-	for(ll i=0; i<registry_vector.size(); i++)
+	/* If all the blocks are compacted, the free memory is after the compacted memory. */
+	if(compact_from==current_index)
 	{
-		registry_map.insert(registry_vector[i]);
+		current_index = compact_to;
+		compacting = false;
+		for(int c=0; c<size_classes; c++)
+			ahead_blocks[c].clear();
 	}
+
+	resume_the_world();
+	pause_latency.record(now_ns()-start);
+	return !compacting;
+}
+
+/*
+ * This function does a step of the compaction with the configured budget, e.g. when the program is idle.
+ * A compaction is started if none is running and the shared lists or the cache of the thread have free blocks.
+ * @return bool: true if no compaction is running.
+ */
+bool step()
+{
+	ThreadCache &cache = thread_cache();
+	lock_manager();
+	bool fragmented = false;
+	for(int c=0; c<size_classes; c++)
+		fragmented = fragmented || !free_blocks[c].empty() || (c<exact_classes && !cache.blocks[c].empty());
+	if(!compacting && fragmented)
+		start_compaction();
+
+	bool done = compaction_step(compaction_budget);
+	manager_lock.unlock();
+	return done;
+}
+
+/*
+ * This function does a full memory compaction after finishing the running compaction, it is called with manager_lock.
+ * Nothing is done if the threads could not be stopped.
+ */
+void compact_memory()
+{
+	if(!compaction_step(0) || !start_compaction())
+		return;
+	compaction_step(0);
 }
 
 /*
- * This function allocates memory, inserts a registry element in the map and returns the id.
+ * This function allocates memory, inserts a registry element in the registry table and returns the id.
+ * A free block is reused if there is one large enough, else the block is allocated from the end
+ * of the buffer. While a compaction runs, each allocation does a step of it. The memory is compacted
+ * only when no free block is large enough and the end of the buffer is too small.
+ * It is called with manager_lock.
  * @param size: number of blocks of memory to be allocated.
  * @return ll: the id of the allocated registry object.
  * If not enough memory to allocate, it returns -1.
  */
 ll allocate_registry(int size)
 {
-	/* if the object can be directly allocated without compaction. */
-	if(total_size-current_index>=size)
+	ll id = -1;
+
+	/* doing a step of the running compaction. */
+	if(compacting)
+		compaction_step(compaction_budget);
+
+	/* reusing a free block. */
+	if(size>0)
+		id = allocate_from_free_list(size);
+
+	/* if the object can be directly allocated, it fails only if the registry table is full. */
+	if(id<0 && total_size-current_index>=size)
+		id = allocate_from_buffer(size);
+
+	/* finishing the running compaction. */
+	if(id<0 && compacting)
 	{
-		/* Allocating memory from buffer without compaction. */
-		ll id = allocate_from_buffer(size);
-		return id;
+		compaction_step(0);
+		if(total_size-current_index>=size)
+			id = allocate_from_buffer(size);
 	}
 
-	/* compacting the memory. */
-	compact_memory();
-
-	/* if memory can be allocated after compaction. */
-	if(total_size-current_index>=size)
+	/* compacting the whole memory. */
+	if(id<0)
 	{
-		/* Allocating memory and returning the id. */
-		ll id = allocate_from_buffer(size);
-		return id;
+		compact_memory();
+		if(total_size-current_index>=size)
+			id = allocate_from_buffer(size);
 	}
 
-	/* If not enough memory to allocate, return -1. */
-	return -1;
+	/* If not enough memory to allocate, id is -1. */
+	return id;
 }
 
 /*
  * This function implements the functionality of the new operator in C++.
+ * The small blocks are allocated from the cache of the thread, the others with manager_lock.
  * @param size: the number of blocks to be allocated.
  * @return MyInt: the MyInt variable allocated.
  */
@@ -311,8 +1152,21 @@ MyInt my_new(int size)
 	/* temporary variable to allocate memory. */
 	MyInt temp;
 
+	safepoint();
+	ThreadCache &cache = thread_cache();
+	ll start = now_ns();
+
 	/* Allocating a new Registry element. */
-	ll id = allocate_registry(size);
+	ll id = -1;
+	if(size>0 && size<=exact_classes)
+		id = allocate_from_cache(size);
+	if(id<0)
+	{
+		lock_manager();
+		id = allocate_registry(size);
+		manager_lock.unlock();
+	}
+	cache.allocation_latency.record(now_ns()-start);
 
 	/* If could not allocate memory, id of the registry is -1. */
 	if(id<0)
@@ -322,7 +1176,7 @@ MyInt my_new(int size)
 	}
 
 	/* Updating the id of the allocated MyInt. */
-	else 
+	else
 		temp.id = id;
 
 	/* returning the object. */
@@ -330,21 +1184,15 @@ MyInt my_new(int size)
 }
 
 /*
- * This function implements the functionality of the delete operator. 
+ * This function implements the functionality of the delete operator.
  * @param num: the MyInt element to be deleted.
  */
 void my_delete(MyInt *num)
 {
-	/* Finding the registry element associated with the MyInt element in the map. */
-	map<ll, Registry>::iterator it = registry_map.find(num->id);
+	safepoint();
 
-	/* Checking if the element exists. */
-	if(it!=registry_map.end())
-	{
-		/* Decreasing the reference count of the registry element. */
-		it->second.reference_count--;
-	}
-	else
+	/* Decreasing the reference count of the registry element, if the element exists. */
+	if(!release_registry(num->id))
 	{
 		/* Element not found in the map. */
 		cout<<"ERROR: No reference to any valid element found.\n";
@@ -353,22 +1201,52 @@ void my_delete(MyInt *num)
 	num->id = -1;
 }
 
+/* This function prints the latencies of my_new() in all the threads, and of the compaction. */
+void show_latency()
+{
+	Histogram allocation_latency;
+	{
+		lock_guard<mutex> lock(safepoint_lock);
+		allocation_latency.add(exited_allocation_latency);
+		for(int i=0; i<(int)thread_caches.size(); i++)
+			allocation_latency.add(thread_caches[i]->allocation_latency);
+	}
+	allocation_latency.show("allocation");
+
+	lock_manager();
+	pause_latency.show("compaction pause");
+	manager_lock.unlock();
+}
+
 /* for debugging. */
 void show_registry()
 {
 	cout<<"Dump:\n";
 
-	map<ll, Registry>::iterator it = registry_map.begin();
-	while(it!=registry_map.end())
+	lock_manager();
+	for(int i=0; i<registry_size; i++)
 	{
-		cout<<it->first<<" "<<it->second.memory_index<<" "<<it->second.block_size<<" "<<it->second.reference_count<<" "<<buffer[it->second.memory_index]<<endl;
-		it++;
+		Registry *it = &registry_element(i);
+		if(it->used)
+			cout<<((it->generation<<index_bits)|i)<<" "<<it->memory_index<<" "<<it->block_size<<" "<<it->reference_count<<" "<<buffer[it->memory_index]<<endl;
 	}
+	manager_lock.unlock();
+}
+
+/*
+ * This function is the trace function of the nodes of the list.
+ * The second int of a node is the link to the next node, -1 for the last node.
+ */
+void trace_list_node(int *block, int /*size*/, vector<ll> &children)
+{
+	if(block[1]>=0)
+		children.push_back(link_id(block[1]));
 }
 
 /*
  * This class is used to implement linked list of integers.
  * The object contains the head of the linked list.
+ * Each function is an AccessScope, so the thread is idle for the compaction between the calls.
  */
 class list
 {
@@ -380,6 +1258,7 @@ class list
 		/* constructor for the object, initialize the id of head to -1 to point to NULL. */
 		list()
 		{
+			AccessScope access;
 			head.update_id(-1);
 		}
 
@@ -389,6 +1268,8 @@ class list
 		 */
 		void list_insert(int num)
 		{	
+			AccessScope access;
+
 			/* if the list is currently empty. */
 			if(head.id==-1)
 			{
@@ -402,6 +1283,7 @@ class list
 				/* storing the number, and updating the next pointer. */
 				head[0] = num;
 				head[1] = -1;
+				register_trace(head, trace_list_node);
 			}
 			else
 			{
@@ -421,12 +1303,13 @@ class list
 
 				/* storing the number, and updating the next node. */
 				head[0] = num;
-				head[1] = temp.id;
+				head[1] = link(temp.id);
+				register_trace(head, trace_list_node);
 
 				/* updating the refernce count. */
-				map<ll, Registry>::iterator it = registry_map.find(temp.id);
-				if(it!=registry_map.end())
-					it->second.reference_count++;
+				Registry *it = find_registry(temp.id);
+				if(it!=NULL)
+					it->reference_count++;
 			}
 		}
 
@@ -436,6 +1319,8 @@ class list
 		 */
 		void list_delete(int num)
 		{
+			AccessScope access;
+
 			/* if the list is empty. */
 			if(head.id==-1)
 			{
@@ -448,14 +1333,9 @@ class list
 			{
 				/* delete the element and update the head of the list. */
 				MyInt temp = head;
-				head.update_id(head[1]);
-
-				/* update the reference count. */
-				map<ll, Registry>::iterator it = registry_map.find(temp[1]);
-				if(it!=registry_map.end())
-					it->second.reference_count--;
+				head.update_id(link_id(head[1]));
 
-				/* deallocate memory. */
+				/* deallocate memory, the reference of the element to the next one is released with it. */
 				my_delete(&temp);
 			}
 			else
@@ -465,18 +1345,20 @@ class list
 				temp = head;
 
 				MyInt temp2;
-				temp2.update_id(temp[1]);
+				temp2.update_id(link_id(temp[1]));
 
 				while(temp2.id!=-1)
 				{
 					if(temp2[0]==num)
 					{
-						/* updating the pointers, and reference count. */
-						temp[1] = temp2[1];
+						/* updating the pointers, and reference count: the next element is referenced by temp now. */
+						int next = temp2[1];
+						temp[1] = next;
+						Registry *it = find_registry(link_id(next));
+						if(it!=NULL)
+							it->reference_count++;
 
-						map<ll, Registry>::iterator it = registry_map.find(temp2.id);
-						if(it!=registry_map.end())
-							it->second.reference_count--;
+						release_registry(temp2.id);
 
 						/* deallocating memory. */
 						my_delete(&temp2);
@@ -484,8 +1366,8 @@ class list
 					}
 
 					/* updating the pointers. */
-					temp.update_id(temp[1]);
-					temp2.update_id(temp2[1]);
+					temp.update_id(link_id(temp[1]));
+					temp2.update_id(link_id(temp2[1]));
 				}
 
 				/* if element not found. */
@@ -496,31 +1378,30 @@ class list
 		/* This function displays the contents of the list. */
 		void list_show()
 		{
+			AccessScope access;
+
 			/* traversing the list. */
 			MyInt temp = head;
 			while(temp.id!=-1)
 			{
 				cout<<temp[0]<<" ";
-				temp.update_id(temp[1]);
+				temp.update_id(link_id(temp[1]));
 			}
 			cout<<endl;
 		}
 
+		/* This function deletes all the elements, they are released by the trace function from the head. */
+		void list_clear()
+		{
+			AccessScope access;
+			head.update_id(-1);
+		}
+
 		/* destructor for the linked list. */
-		/*~list()
+		~list()
 		{
-			cout<<"in\n";
-			MyInt temp;
-			while(head.id!=-1)
-			{
-				cout<<"dest"<<" "<<head.id<<endl;
-				temp = head;
-				cout<<head[1]<<endl;
-				head.update_id(head[1]);
-				my_delete(&temp);
-			}
-			cout<<"out\n";
-		}*/
+			list_clear();
+		}
 };
 
 
@@ -565,6 +1446,18 @@ int main()
 		{
 			interger_list.list_show();
 		}
+		else if(strcmp(input, "compactionBudget")==0)
+		{
+			fscanf(ptr, "%d", &compaction_budget);
+		}
+		else if(strcmp(input, "step")==0)
+		{
+			step();
+		}
+		else if(strcmp(input, "latency")==0)
+		{
+			show_latency();
+		}
 		else
 		{
 			cout<<"ERROR: Not a valid operation.\n";
@@ -572,6 +1465,8 @@ int main()
 	}
 
 
-	delete[](buffer);
+	/* releasing the list before the buffer. */
+	interger_list.list_clear();
+	free(buffer);
 	return 0;
 }